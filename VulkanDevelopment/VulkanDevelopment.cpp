@@ -13,6 +13,24 @@ int main(int argc, char* argv[])
 {
 	VulkanEngine engine;
 
+	//--headless renders offscreen without a window, --frames sets how many frames it renders.
+	//--trace writes the CPU zones to a Chrome trace file when the run ends, --frame-stats the frame timings as CSV
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "--headless") {
+			engine._headless = true;
+		}
+		else if (arg == "--frames" && i + 1 < argc) {
+			engine._headlessFrames = (uint32_t)stoul(argv[++i]);
+		}
+		else if (arg == "--trace" && i + 1 < argc) {
+			engine._traceOutput = argv[++i];
+		}
+		else if (arg == "--frame-stats" && i + 1 < argc) {
+			engine._frameStatsOutput = argv[++i];
+		}
+	}
+
 	engine.init();
 
 	engine.run();
@@ -0,0 +1,43 @@
+// bench_common.h : timing, argument parsing and the thread count sweep shared by the micro-benchmarks.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+namespace bench {
+	inline double elapsed_ns(std::chrono::high_resolution_clock::time_point start)
+	{
+		return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	//positional argument index as a number, fallback when it wasn't given
+	inline uint32_t arg_u32(int argc, char* argv[], int index, uint32_t fallback)
+	{
+		return argc > index ? (uint32_t)atoi(argv[index]) : fallback;
+	}
+
+	//positional argument index as the highest thread count to measure. Defaults to the hardware threads, at least 1
+	inline uint32_t arg_max_threads(int argc, char* argv[], int index)
+	{
+		uint32_t maxThreads = arg_u32(argc, argv, index, std::thread::hardware_concurrency());
+		return maxThreads > 0 ? maxThreads : 1;
+	}
+
+	//1, 2, 4... up to maxThreads, and maxThreads itself when it isn't a power of two, so the full width of
+	//machines with 12 or 24 threads is measured too
+	inline std::vector<uint32_t> thread_counts(uint32_t maxThreads)
+	{
+		std::vector<uint32_t> counts;
+		for (uint32_t threads = 1; threads <= maxThreads; threads *= 2) {
+			counts.push_back(threads);
+		}
+		if (counts.back() != maxThreads) {
+			counts.push_back(maxThreads);
+		}
+		return counts;
+	}
+}
@@ -0,0 +1,112 @@
+// cull_benchmark.cpp : measures frustum culling of bounding spheres, scalar against SSE and AVX.
+//
+// usage: CullBenchmark [sphereCount] [threadCount]
+
+#include "bench_common.h"
+
+#include <vk_culling.h>
+#include <vk_ecs.h>
+#include <vk_gameobject.h>
+#include <vk_jobs.h>
+#include <vk_render_systems.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace std::chrono;
+
+using CullFunction = uint32_t(*)(const Frustum&, const glm::vec4*, uint32_t, uint32_t, uint32_t*);
+
+//spheres scattered around the camera, so about a fifth of them end up inside
+static std::vector<glm::vec4> make_spheres(uint32_t count)
+{
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> position(-200.f, 200.f);
+	std::uniform_real_distribution<float> radius(0.1f, 4.f);
+
+	std::vector<glm::vec4> spheres(count);
+	for (glm::vec4& sphere : spheres) {
+		sphere = glm::vec4(position(rng), position(rng) * 0.25f, position(rng), radius(rng));
+	}
+	return spheres;
+}
+
+static void bench_function(const char* name, CullFunction function, const Frustum& frustum,
+	const std::vector<glm::vec4>& spheres, uint32_t rounds, uint32_t expectedVisible)
+{
+	uint32_t count = (uint32_t)spheres.size();
+	std::vector<uint32_t> visible(count);
+
+	uint32_t visibleCount = 0;
+	auto start = high_resolution_clock::now();
+	for (uint32_t r = 0; r < rounds; r++) {
+		visibleCount = function(frustum, spheres.data(), count, 0, visible.data());
+	}
+	double ns = bench::elapsed_ns(start) / rounds;
+
+	printf("%-8s %8u spheres: %7.3f ms, %8.1f M objects/s, %u visible%s\n",
+		name, count, ns / 1e6, count / ns * 1e3, visibleCount,
+		visibleCount == expectedVisible ? "" : " (differs from scalar)");
+}
+
+//the engine path: cull() over the bounds pool of a registry, split into jobs, with the compaction
+static void bench_registry(const Frustum& frustum, const std::vector<glm::vec4>& spheres, uint32_t threadCount, uint32_t rounds)
+{
+	JobSystem jobs;
+	jobs.init(threadCount);
+
+	Registry registry;
+	for (const glm::vec4& sphere : spheres) {
+		registry.add<BoundsComponent>(registry.create(), { sphere });
+	}
+
+	std::vector<uint32_t> visible;
+	auto start = high_resolution_clock::now();
+	for (uint32_t r = 0; r < rounds; r++) {
+		rendersys::cull(registry, frustum, jobs, visible);
+	}
+	double ns = bench::elapsed_ns(start) / rounds;
+
+	uint32_t count = (uint32_t)spheres.size();
+	printf("registry %8u spheres, threads %2u: %7.3f ms, %8.1f M objects/s, %u visible\n",
+		count, threadCount, ns / 1e6, count > 0 ? count / ns * 1e3 : 0.0, (uint32_t)visible.size());
+
+	jobs.shutdown();
+}
+
+int main(int argc, char* argv[])
+{
+	uint32_t sphereCount = bench::arg_u32(argc, argv, 1, 1000000);
+	uint32_t maxThreads = bench::arg_max_threads(argc, argv, 2);
+
+	glm::mat4 view = glm::lookAt(glm::vec3(0.f, 10.f, -30.f), glm::vec3(0.f, 0.f, 50.f), glm::vec3(0.f, 1.f, 0.f));
+	glm::mat4 projection = glm::perspective(glm::radians(70.f), 1700.f / 900.f, 0.1f, 200.f);
+	Frustum frustum = make_frustum(projection * view);
+
+	std::vector<glm::vec4> spheres = make_spheres(sphereCount);
+
+	printf("cull_spheres uses %s\n", cull_spheres_instruction_set());
+
+	std::vector<uint32_t> scratch(sphereCount);
+	uint32_t expectedVisible = cull_spheres_scalar(frustum, spheres.data(), sphereCount, 0, scratch.data());
+
+	bench_function("scalar", cull_spheres_scalar, frustum, spheres, 20, expectedVisible);
+#if VK_CULLING_SSE
+	bench_function("sse", cull_spheres_sse, frustum, spheres, 20, expectedVisible);
+#endif
+#if VK_CULLING_AVX
+	bench_function("avx", cull_spheres_avx, frustum, spheres, 20, expectedVisible);
+#endif
+
+	//an empty scene has to come back empty, not crash
+	bench_registry(frustum, std::vector<glm::vec4>(), 1, 1);
+	for (uint32_t threads : bench::thread_counts(maxThreads)) {
+		bench_registry(frustum, spheres, threads, 20);
+	}
+
+	return 0;
+}
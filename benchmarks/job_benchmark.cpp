@@ -0,0 +1,132 @@
+// job_benchmark.cpp : measures the fixed costs of the job system.
+//
+// usage: JobBenchmark [jobCount] [threadCount]
+
+#include "bench_common.h"
+
+#include <vk_jobs.h>
+
+#include <chrono>
+#include <cstdio>
+
+using namespace std::chrono;
+
+//queue jobCount empty jobs from the main thread and wait for them. With one thread this is the pure
+//spawn + execute cost; with more, idle workers steal from the main thread's deque.
+//Jobs are queued in batches that fit the deque, so none of them take the locked overflow queue
+static void bench_spawn(uint32_t threadCount, uint32_t jobCount)
+{
+	JobSystem jobs;
+	jobs.init(threadCount);
+
+	//warm up the allocator and wake the workers
+	JobCounter warmup;
+	for (uint32_t i = 0; i < 1024; i++) {
+		jobs.run([]() {}, &warmup);
+	}
+	jobs.wait(&warmup);
+
+	uint64_t stealsBefore = jobs.steal_count();
+
+	double spawnNs = 0.0;
+	auto start = high_resolution_clock::now();
+
+	for (uint32_t first = 0; first < jobCount; first += (uint32_t)WorkStealingQueue::CAPACITY) {
+		uint32_t batch = jobCount - first < (uint32_t)WorkStealingQueue::CAPACITY ? jobCount - first : (uint32_t)WorkStealingQueue::CAPACITY;
+
+		auto batchStart = high_resolution_clock::now();
+		JobCounter counter;
+		for (uint32_t i = 0; i < batch; i++) {
+			jobs.run([]() {}, &counter);
+		}
+		spawnNs += bench::elapsed_ns(batchStart);
+
+		jobs.wait(&counter);
+	}
+	double totalNs = bench::elapsed_ns(start);
+
+	uint64_t steals = jobs.steal_count() - stealsBefore;
+
+	printf("spawn        threads %2u: %8.1f ns/job spawn, %8.1f ns/job spawn+run, %5.1f%% stolen\n",
+		threadCount, spawnNs / jobCount, totalNs / jobCount, 100.0 * steals / jobCount);
+
+	jobs.shutdown();
+}
+
+//queues all jobCount jobs before waiting. Everything past the deque capacity goes to the shared queue,
+//so this measures the mutex protected overflow path rather than the deque
+static void bench_spawn_overflow(uint32_t threadCount, uint32_t jobCount)
+{
+	JobSystem jobs;
+	jobs.init(threadCount);
+
+	auto start = high_resolution_clock::now();
+
+	JobCounter counter;
+	for (uint32_t i = 0; i < jobCount; i++) {
+		jobs.run([]() {}, &counter);
+	}
+	double spawnNs = bench::elapsed_ns(start);
+
+	jobs.wait(&counter);
+	double totalNs = bench::elapsed_ns(start);
+
+	printf("overflow     threads %2u: %8.1f ns/job spawn, %8.1f ns/job spawn+run\n",
+		threadCount, spawnNs / jobCount, totalNs / jobCount);
+
+	jobs.shutdown();
+}
+
+//one parallel_for with a group per thread, repeated. This is the round trip a frame pays for every fan-out
+static void bench_fanout(uint32_t threadCount, uint32_t rounds)
+{
+	JobSystem jobs;
+	jobs.init(threadCount);
+
+	auto start = high_resolution_clock::now();
+
+	for (uint32_t r = 0; r < rounds; r++) {
+		JobCounter counter;
+		jobs.parallel_for(threadCount, 1, [](uint32_t, uint32_t) {}, &counter);
+		jobs.wait(&counter);
+	}
+
+	printf("fan-out      threads %2u: %8.1f ns/parallel_for\n", threadCount, bench::elapsed_ns(start) / rounds);
+
+	jobs.shutdown();
+}
+
+//a chain of dependent jobs, each held back until the previous one finished
+static void bench_dependency_chain(uint32_t threadCount, uint32_t length)
+{
+	JobSystem jobs;
+	jobs.init(threadCount);
+
+	std::vector<JobCounter> counters(length);
+
+	auto start = high_resolution_clock::now();
+
+	for (uint32_t i = 0; i < length; i++) {
+		jobs.run([]() {}, &counters[i], i > 0 ? &counters[i - 1] : nullptr);
+	}
+	jobs.wait(&counters[length - 1]);
+
+	printf("dependencies threads %2u: %8.1f ns/link\n", threadCount, bench::elapsed_ns(start) / length);
+
+	jobs.shutdown();
+}
+
+int main(int argc, char* argv[])
+{
+	uint32_t jobCount = bench::arg_u32(argc, argv, 1, 1000000);
+	uint32_t maxThreads = bench::arg_max_threads(argc, argv, 2);
+
+	for (uint32_t threads : bench::thread_counts(maxThreads)) {
+		bench_spawn(threads, jobCount);
+		bench_spawn_overflow(threads, jobCount);
+		bench_fanout(threads, jobCount / 100);
+		bench_dependency_chain(threads, jobCount / 100);
+	}
+
+	return 0;
+}
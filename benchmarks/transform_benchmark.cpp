@@ -0,0 +1,98 @@
+// transform_benchmark.cpp : measures world matrix updates of large transform hierarchies.
+//
+// usage: TransformBenchmark [nodeCount] [threadCount]
+
+#include "bench_common.h"
+
+#include <vk_transform.h>
+#include <vk_jobs.h>
+
+#include <chrono>
+#include <cstdio>
+
+using namespace std::chrono;
+
+//a forest of roots with branching children, so there are a handful of wide depth levels like a real scene
+static void build_scene(TransformHierarchy& transforms, std::vector<TransformId>& roots, uint32_t nodeCount, uint32_t branching)
+{
+	std::vector<TransformId> nodes;
+	nodes.reserve(nodeCount);
+
+	uint32_t rootCount = nodeCount / 64 > 0 ? nodeCount / 64 : 1;
+	for (uint32_t i = 0; i < nodeCount; i++) {
+		TransformId parent = i < rootCount ? INVALID_TRANSFORM : nodes[(i - rootCount) / branching];
+		TransformId node = transforms.create(parent);
+		transforms.set_position(node, glm::vec3{ (float)(i % 7), 0.5f, -0.25f });
+		transforms.set_rotation(node, glm::angleAxis(0.01f * (i % 13), glm::vec3{ 0.f, 1.f, 0.f }));
+		nodes.push_back(node);
+		if (i < rootCount) {
+			roots.push_back(node);
+		}
+	}
+}
+
+//moves every root, which dirties the whole hierarchy, then updates it
+static void bench_update(uint32_t nodeCount, uint32_t threadCount, uint32_t rounds)
+{
+	JobSystem jobs;
+	jobs.init(threadCount);
+
+	TransformHierarchy transforms;
+	std::vector<TransformId> roots;
+	build_scene(transforms, roots, nodeCount, 4);
+
+	//the first update sorts and computes everything
+	transforms.update();
+
+	double linearNs = 0.0;
+	double parallelNs = 0.0;
+	for (uint32_t r = 0; r < rounds; r++) {
+		for (TransformId root : roots) {
+			transforms.set_position(root, glm::vec3{ (float)r, 0.f, 0.f });
+		}
+		auto start = high_resolution_clock::now();
+		transforms.update();
+		linearNs += bench::elapsed_ns(start);
+
+		for (TransformId root : roots) {
+			transforms.set_position(root, glm::vec3{ 0.f, (float)r, 0.f });
+		}
+		start = high_resolution_clock::now();
+		transforms.update_parallel(jobs);
+		parallelNs += bench::elapsed_ns(start);
+	}
+
+	printf("update %7u nodes, %2u levels, threads %2u: linear %7.3f ms (%5.1f ns/node), parallel %7.3f ms (%5.1f ns/node)\n",
+		nodeCount, transforms.level_count(), threadCount,
+		linearNs / rounds / 1e6, linearNs / rounds / nodeCount, parallelNs / rounds / 1e6, parallelNs / rounds / nodeCount);
+
+	jobs.shutdown();
+}
+
+//moving nothing should cost one pass over the flags
+static void bench_clean(uint32_t nodeCount, uint32_t rounds)
+{
+	TransformHierarchy transforms;
+	std::vector<TransformId> roots;
+	build_scene(transforms, roots, nodeCount, 4);
+	transforms.update();
+
+	auto start = high_resolution_clock::now();
+	for (uint32_t r = 0; r < rounds; r++) {
+		transforms.update();
+	}
+	printf("clean  %7u nodes: %7.3f ms\n", nodeCount, bench::elapsed_ns(start) / rounds / 1e6);
+}
+
+int main(int argc, char* argv[])
+{
+	uint32_t nodeCount = bench::arg_u32(argc, argv, 1, 100000);
+	uint32_t maxThreads = bench::arg_max_threads(argc, argv, 2);
+
+	bench_clean(nodeCount, 100);
+	for (uint32_t threads : bench::thread_counts(maxThreads)) {
+		bench_update(nodeCount, threads, 20);
+	}
+
+	return 0;
+}
@@ -0,0 +1,361 @@
+// vulkan_benchmark.cpp : renders a synthetic scene headless along a fixed camera path and writes a JSON report.
+//
+// usage: VulkanBenchmark [--objects N] [--meshes M] [--materials K] [--frames F] [--warmup W] [--seed S]
+//                        [--path cpu|cpu-serial|gpu] [--width X] [--height Y] [--output report.json]
+//
+// Everything that goes into the scene and the camera comes from the arguments, so two runs with the same
+// arguments render the same frames. Keys in the report never change order, runs can be diffed directly.
+
+#include <vk_engine.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtx/transform.hpp>
+
+using namespace std::chrono;
+
+//bump when a key is added, removed or changes meaning
+static const int REPORT_FORMAT = 1;
+
+struct BenchmarkConfig {
+	uint32_t objects{ 10000 };
+	uint32_t meshes{ 8 };
+	uint32_t materials{ 4 };
+	uint32_t frames{ 1000 };
+	uint32_t warmup{ 60 };
+	uint32_t seed{ 1 };
+	std::string path{ "cpu" };
+	uint32_t width{ 1280 };
+	uint32_t height{ 720 };
+	std::string output;
+};
+
+struct Percentiles {
+	double mean{ 0 };
+	double p50{ 0 };
+	double p90{ 0 };
+	double p95{ 0 };
+	double p99{ 0 };
+	double max{ 0 };
+};
+
+//xorshift32, the scene layout must not depend on the standard library's generators
+class Random {
+public:
+	explicit Random(uint32_t seed) : _state(seed ? seed : 1) {}
+
+	uint32_t next()
+	{
+		_state ^= _state << 13;
+		_state ^= _state >> 17;
+		_state ^= _state << 5;
+		return _state;
+	}
+
+	float next_float() { return (next() >> 8) * (1.0f / 16777216.0f); }
+
+private:
+	uint32_t _state;
+};
+
+static bool parse_args(int argc, char* argv[], BenchmarkConfig& config)
+{
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (i + 1 >= argc) {
+			fprintf(stderr, "missing value for %s\n", arg.c_str());
+			return false;
+		}
+		const char* value = argv[++i];
+
+		if (arg == "--objects") config.objects = (uint32_t)atoi(value);
+		else if (arg == "--meshes") config.meshes = std::max((uint32_t)atoi(value), 1u);
+		else if (arg == "--materials") config.materials = std::max((uint32_t)atoi(value), 1u);
+		else if (arg == "--frames") config.frames = std::max((uint32_t)atoi(value), 1u);
+		else if (arg == "--warmup") config.warmup = (uint32_t)atoi(value);
+		else if (arg == "--seed") config.seed = (uint32_t)atoi(value);
+		else if (arg == "--path") config.path = value;
+		else if (arg == "--width") config.width = std::max((uint32_t)atoi(value), 1u);
+		else if (arg == "--height") config.height = std::max((uint32_t)atoi(value), 1u);
+		else if (arg == "--output") config.output = value;
+		else {
+			fprintf(stderr, "unknown argument %s\n", arg.c_str());
+			return false;
+		}
+	}
+
+	if (config.path != "cpu" && config.path != "cpu-serial" && config.path != "gpu") {
+		fprintf(stderr, "--path must be cpu, cpu-serial or gpu\n");
+		return false;
+	}
+	return true;
+}
+
+//UV sphere of unit radius. Meshes get finer with their index so they cost different amounts to draw
+static Mesh make_sphere(uint32_t index)
+{
+	uint32_t rings = 6 + index * 4;
+	uint32_t segments = rings * 2;
+
+	glm::vec3 color = {
+		0.3f + 0.7f * ((index * 37) % 11) / 10.f,
+		0.3f + 0.7f * ((index * 53) % 7) / 6.f,
+		0.3f + 0.7f * ((index * 71) % 5) / 4.f,
+	};
+
+	Mesh mesh;
+	for (uint32_t r = 0; r <= rings; r++) {
+		float theta = glm::pi<float>() * r / rings;
+		for (uint32_t s = 0; s <= segments; s++) {
+			float phi = 2.f * glm::pi<float>() * s / segments;
+
+			Vertex vertex;
+			vertex.normal = { std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi) };
+			vertex.position = vertex.normal;
+			vertex.color = color;
+			mesh._vertices.push_back(vertex);
+		}
+	}
+
+	for (uint32_t r = 0; r < rings; r++) {
+		for (uint32_t s = 0; s < segments; s++) {
+			uint32_t a = r * (segments + 1) + s;
+			uint32_t b = a + segments + 1;
+			mesh._indices.insert(mesh._indices.end(), { a, b, a + 1, a + 1, b, b + 1 });
+		}
+	}
+
+	mesh.compute_bounds();
+	return mesh;
+}
+
+//replaces the engine's default scene with config.objects spheres scattered through a cube
+static float build_scene(VulkanEngine& engine, const BenchmarkConfig& config)
+{
+	std::vector<Mesh*> meshes;
+	for (uint32_t i = 0; i < config.meshes; i++) {
+		meshes.push_back(engine.add_mesh("benchmark_mesh_" + std::to_string(i), make_sphere(i)));
+	}
+	engine.flush_uploads();
+
+	//all share the default pipelines. They only differ in identity, which is what splits batches and sort keys
+	Material* defaultMaterial = engine.get_material("defaultmesh");
+	std::vector<Material*> materials;
+	for (uint32_t i = 0; i < config.materials; i++) {
+		Material* material = engine.create_material(defaultMaterial->pipeline, defaultMaterial->pipelineLayout,
+			"benchmark_material_" + std::to_string(i), defaultMaterial->instancedPipeline);
+		material->indirectPipeline = defaultMaterial->indirectPipeline;
+		materials.push_back(material);
+	}
+
+	//roughly constant density, so larger scenes spread out instead of piling up
+	float extent = 2.f * std::cbrt((float)config.objects);
+
+	Random random(config.seed);
+	engine.clear_scene();
+	for (uint32_t i = 0; i < config.objects; i++) {
+		glm::vec3 position = {
+			(random.next_float() - 0.5f) * extent,
+			(random.next_float() - 0.5f) * extent,
+			(random.next_float() - 0.5f) * extent,
+		};
+		float scale = 0.2f + 0.3f * random.next_float();
+
+		Mesh* mesh = meshes[random.next() % config.meshes];
+		Material* material = materials[random.next() % config.materials];
+		engine.create_renderable(mesh, material, glm::translate(position) * glm::scale(glm::vec3(scale)));
+	}
+
+	return extent;
+}
+
+//one orbit around the scene over the measured frames, starting during warmup
+static void place_camera(VulkanEngine& engine, float extent, uint32_t frame, uint32_t frameCount)
+{
+	float angle = 2.f * glm::pi<float>() * frame / frameCount;
+	float radius = extent;
+	float height = extent * 0.25f;
+
+	//update_camera() translates by _camPos, then yaws and pitches, both in degrees
+	engine._camPos = -glm::vec3(radius * std::sin(angle), height, radius * std::cos(angle));
+	engine.yaw = -glm::degrees(angle);
+	engine.pitch = glm::degrees(std::atan2(height, radius));
+}
+
+static Percentiles percentiles(std::vector<double> values)
+{
+	Percentiles result;
+	if (values.empty()) {
+		return result;
+	}
+
+	std::sort(values.begin(), values.end());
+
+	//nearest rank
+	auto rank = [&](double p) {
+		size_t index = (size_t)std::ceil(p / 100.0 * values.size());
+		return values[std::min(std::max(index, (size_t)1), values.size()) - 1];
+	};
+
+	double sum = 0;
+	for (double value : values) {
+		sum += value;
+	}
+
+	result.mean = sum / values.size();
+	result.p50 = rank(50);
+	result.p90 = rank(90);
+	result.p95 = rank(95);
+	result.p99 = rank(99);
+	result.max = values.back();
+	return result;
+}
+
+static std::string json_string(const char* text)
+{
+	std::string result = "\"";
+	for (const char* c = text; *c; c++) {
+		if (*c == '"' || *c == '\\') {
+			result += '\\';
+			result += *c;
+		}
+		else if ((unsigned char)*c < 0x20) {
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", *c);
+			result += escaped;
+		}
+		else {
+			result += *c;
+		}
+	}
+	return result + "\"";
+}
+
+static void write_percentiles(FILE* out, const char* name, const Percentiles& p, bool last)
+{
+	fprintf(out, "  \"%s\": { \"mean\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f }%s\n",
+		name, p.mean, p.p50, p.p90, p.p95, p.p99, p.max, last ? "" : ",");
+}
+
+int main(int argc, char* argv[])
+{
+	BenchmarkConfig config;
+	if (!parse_args(argc, argv, config)) {
+		return 1;
+	}
+
+	VulkanEngine engine;
+	engine._headless = true;
+	engine._windowExtent = { config.width, config.height };
+	engine._parallelRecording = config.path != "cpu-serial";
+	engine._renderPath = config.path == "gpu" ? RenderPath::GPUDriven : RenderPath::CPU;
+
+	engine.init();
+
+	if (config.path == "gpu" && !engine.gpu_driven_supported()) {
+		fprintf(stderr, "the GPU-driven path is not supported on this device, the CPU path is measured instead\n");
+	}
+
+	float extent = build_scene(engine, config);
+
+	//pipelines compiling in the background would make the first frames differ between runs
+	engine.wait_for_pipelines();
+
+	std::vector<double> cpuFrameTimes;
+	std::vector<double> gpuFrameTimes;
+	cpuFrameTimes.reserve(config.frames);
+	gpuFrameTimes.reserve(config.frames);
+
+	double drawCalls = 0, instancedDraws = 0, pipelineBinds = 0, vertexBufferBinds = 0, drawnObjects = 0;
+
+	uint32_t totalFrames = config.warmup + config.frames;
+	for (uint32_t frame = 0; frame < totalFrames; frame++) {
+		place_camera(engine, extent, frame, config.frames);
+
+		auto start = high_resolution_clock::now();
+		engine.draw();
+		double frameMs = duration_cast<nanoseconds>(high_resolution_clock::now() - start).count() / 1000000.0;
+
+		if (frame < config.warmup) {
+			continue;
+		}
+
+		cpuFrameTimes.push_back(frameMs);
+
+		//lags by the frames in flight, which only shifts the window
+		if (engine.gpu_frame_time() >= 0.f) {
+			gpuFrameTimes.push_back(engine.gpu_frame_time());
+		}
+
+		drawCalls += engine._drawStats.drawCalls;
+		instancedDraws += engine._drawStats.instancedDraws;
+		pipelineBinds += engine._drawStats.pipelineBinds;
+		vertexBufferBinds += engine._drawStats.vertexBufferBinds;
+		drawnObjects += engine._drawStats.objects;
+	}
+
+	vkDeviceWaitIdle(engine._device);
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(engine._chosenGPU, &properties);
+
+	const VkPhysicalDeviceMemoryProperties* memoryProperties;
+	vmaGetMemoryProperties(engine._allocator, &memoryProperties);
+
+	VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+	vmaGetBudget(engine._allocator, budgets);
+
+	FILE* out = config.output.empty() ? stdout : fopen(config.output.c_str(), "w");
+	if (!out) {
+		fprintf(stderr, "can't open %s\n", config.output.c_str());
+		engine.cleanup();
+		return 1;
+	}
+
+	double frames = (double)config.frames;
+
+	fprintf(out, "{\n");
+	fprintf(out, "  \"format\": %d,\n", REPORT_FORMAT);
+	fprintf(out, "  \"device\": { \"name\": %s, \"vendorId\": %u, \"deviceId\": %u, \"driverVersion\": %u },\n",
+		json_string(properties.deviceName).c_str(), properties.vendorID, properties.deviceID, properties.driverVersion);
+	fprintf(out, "  \"scene\": { \"objects\": %u, \"meshes\": %u, \"materials\": %u, \"seed\": %u },\n",
+		config.objects, config.meshes, config.materials, config.seed);
+	fprintf(out, "  \"run\": { \"path\": %s, \"frames\": %u, \"warmupFrames\": %u, \"width\": %u, \"height\": %u, \"framesInFlight\": %u, \"recordingThreads\": %u },\n",
+		json_string(config.path.c_str()).c_str(), config.frames, config.warmup, engine._windowExtent.width, engine._windowExtent.height,
+		engine._framesInFlight, engine._recordingThreads);
+	write_percentiles(out, "cpuFrameMs", percentiles(cpuFrameTimes), false);
+	if (gpuFrameTimes.empty()) {
+		fprintf(out, "  \"gpuFrameMs\": null,\n");
+	}
+	else {
+		write_percentiles(out, "gpuFrameMs", percentiles(gpuFrameTimes), false);
+	}
+	fprintf(out, "  \"perFrame\": { \"objects\": %.2f, \"drawCalls\": %.2f, \"instancedDraws\": %.2f, \"pipelineBinds\": %.2f, \"vertexBufferBinds\": %.2f, \"stateChanges\": %.2f },\n",
+		drawnObjects / frames, drawCalls / frames, instancedDraws / frames, pipelineBinds / frames, vertexBufferBinds / frames,
+		(pipelineBinds + vertexBufferBinds) / frames);
+	fprintf(out, "  \"memoryHeaps\": [\n");
+	for (uint32_t i = 0; i < memoryProperties->memoryHeapCount; i++) {
+		bool deviceLocal = (memoryProperties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+		fprintf(out, "    { \"heap\": %u, \"deviceLocal\": %s, \"blockBytes\": %llu, \"allocationBytes\": %llu, \"usageBytes\": %llu, \"budgetBytes\": %llu }%s\n",
+			i, deviceLocal ? "true" : "false",
+			(unsigned long long)budgets[i].blockBytes, (unsigned long long)budgets[i].allocationBytes,
+			(unsigned long long)budgets[i].usage, (unsigned long long)budgets[i].budget,
+			i + 1 < memoryProperties->memoryHeapCount ? "," : "");
+	}
+	fprintf(out, "  ]\n");
+	fprintf(out, "}\n");
+
+	if (out != stdout) {
+		fclose(out);
+	}
+
+	engine.cleanup();
+	return 0;
+}
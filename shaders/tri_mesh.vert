@@ -1,10 +1,15 @@
 #version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "vertex_decode.glsl"
 
 layout (location = 0) in vec3 vPosition;
 layout (location = 1) in vec3 vNormal;
 layout (location = 2) in vec3 vColor;
 
 layout (location = 0) out vec3 outColor;
+//object space normal, decoded the same way for both vertex formats
+layout (location = 1) out vec3 outNormal;
 
 //push constants block
 layout( push_constant ) uniform constants
@@ -15,6 +20,7 @@ layout( push_constant ) uniform constants
 
 void main()
 {
-	gl_Position = PushConstants.render_matrix * vec4(vPosition, 1.0f);
+	gl_Position = PushConstants.render_matrix * vec4(decode_position(vPosition, PushConstants.data), 1.0f);
 	outColor = vColor;
+	outNormal = decode_normal(vNormal);
 }
\ No newline at end of file
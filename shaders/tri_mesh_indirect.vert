@@ -0,0 +1,42 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "vertex_decode.glsl"
+
+layout (location = 0) in vec3 vPosition;
+layout (location = 1) in vec3 vNormal;
+layout (location = 2) in vec3 vColor;
+
+layout (location = 0) out vec3 outColor;
+//object space normal, decoded the same way for both vertex formats
+layout (location = 1) out vec3 outNormal;
+
+struct ObjectData {
+	mat4 model;
+	vec4 sphereBounds;
+	uint batchIndex;
+	uint pad0;
+	uint pad1;
+	uint pad2;
+};
+
+//all object transforms of the scene, written once when it changes
+layout (std430, set = 0, binding = 0) readonly buffer ObjectBuffer {
+	ObjectData objects[];
+} objectBuffer;
+
+//push constants block. For indirect draws render_matrix is the view-projection matrix
+layout( push_constant ) uniform constants
+{
+	vec4 data;
+	mat4 render_matrix;
+} PushConstants;
+
+void main()
+{
+	//the culling shader stores the object index as firstInstance
+	mat4 model = objectBuffer.objects[gl_InstanceIndex].model;
+	gl_Position = PushConstants.render_matrix * model * vec4(decode_position(vPosition, PushConstants.data), 1.0f);
+	outColor = vColor;
+	outNormal = decode_normal(vNormal);
+}
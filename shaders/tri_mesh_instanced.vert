@@ -0,0 +1,29 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "vertex_decode.glsl"
+
+layout (location = 0) in vec3 vPosition;
+layout (location = 1) in vec3 vNormal;
+layout (location = 2) in vec3 vColor;
+
+//per-instance model matrix, one column per location
+layout (location = 3) in mat4 instanceModel;
+
+layout (location = 0) out vec3 outColor;
+//object space normal, decoded the same way for both vertex formats
+layout (location = 1) out vec3 outNormal;
+
+//push constants block. For instanced draws render_matrix is the view-projection matrix
+layout( push_constant ) uniform constants
+{
+	vec4 data;
+	mat4 render_matrix;
+} PushConstants;
+
+void main()
+{
+	gl_Position = PushConstants.render_matrix * instanceModel * vec4(decode_position(vPosition, PushConstants.data), 1.0f);
+	outColor = vColor;
+	outNormal = decode_normal(vNormal);
+}
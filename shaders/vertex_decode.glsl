@@ -0,0 +1,24 @@
+//included by the mesh vertex shaders. Meshes in the compact vertex format store snorm16 positions
+//relative to their bounds, octahedral snorm16 normals and unorm8 colors
+
+layout (constant_id = 0) const bool COMPACT_VERTICES = false;
+
+//dequantization holds the mesh offset in xyz and its scale in w
+vec3 decode_position(vec3 position, vec4 dequantization)
+{
+	return COMPACT_VERTICES ? position * dequantization.w + dequantization.xyz : position;
+}
+
+vec3 oct_decode(vec2 encoded)
+{
+	vec3 normal = vec3(encoded, 1.0f - abs(encoded.x) - abs(encoded.y));
+	float t = max(-normal.z, 0.0f);
+	normal.x += normal.x >= 0.0f ? -t : t;
+	normal.y += normal.y >= 0.0f ? -t : t;
+	return normalize(normal);
+}
+
+vec3 decode_normal(vec3 normal)
+{
+	return COMPACT_VERTICES ? oct_decode(normal.xy) : normal;
+}
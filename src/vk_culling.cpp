@@ -0,0 +1,171 @@
+#include "vk_culling.h"
+
+#if VK_CULLING_AVX
+#include <immintrin.h>
+#elif VK_CULLING_SSE
+#include <emmintrin.h>
+#endif
+
+
+Frustum make_frustum(const glm::mat4& viewProjection)
+{
+	//glm is column major, so row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+	glm::vec4 row0 = { viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0] };
+	glm::vec4 row1 = { viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1] };
+	glm::vec4 row2 = { viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2] };
+	glm::vec4 row3 = { viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3] };
+
+	Frustum frustum;
+	frustum.planes[0] = row3 + row0; //left
+	frustum.planes[1] = row3 - row0; //right
+	frustum.planes[2] = row3 + row1; //bottom
+	frustum.planes[3] = row3 - row1; //top
+	frustum.planes[4] = row3 + row2; //near, for a -1..1 clip depth as glm::perspective produces
+	frustum.planes[5] = row3 - row2; //far
+
+	for (glm::vec4& plane : frustum.planes) {
+		plane /= glm::length(glm::vec3(plane));
+	}
+	return frustum;
+}
+
+bool sphere_in_frustum(const Frustum& frustum, const glm::vec3& center, float radius)
+{
+	for (const glm::vec4& plane : frustum.planes) {
+		if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+			return false;
+		}
+	}
+	return true;
+}
+
+uint32_t cull_spheres(const Frustum& frustum, const glm::vec4* spheres, uint32_t count, uint32_t firstIndex, uint32_t* visible)
+{
+#if VK_CULLING_AVX
+	return cull_spheres_avx(frustum, spheres, count, firstIndex, visible);
+#elif VK_CULLING_SSE
+	return cull_spheres_sse(frustum, spheres, count, firstIndex, visible);
+#else
+	return cull_spheres_scalar(frustum, spheres, count, firstIndex, visible);
+#endif
+}
+
+const char* cull_spheres_instruction_set()
+{
+#if VK_CULLING_AVX
+	return "AVX";
+#elif VK_CULLING_SSE
+	return "SSE";
+#else
+	return "scalar";
+#endif
+}
+
+uint32_t cull_spheres_scalar(const Frustum& frustum, const glm::vec4* spheres, uint32_t count, uint32_t firstIndex, uint32_t* visible)
+{
+	uint32_t visibleCount = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		//every index is written, only the visible ones are kept by advancing past them. No branch to mispredict
+		visible[visibleCount] = firstIndex + i;
+		visibleCount += sphere_in_frustum(frustum, glm::vec3(spheres[i]), spheres[i].w) ? 1 : 0;
+	}
+	return visibleCount;
+}
+
+#if VK_CULLING_SSE
+uint32_t cull_spheres_sse(const Frustum& frustum, const glm::vec4* spheres, uint32_t count, uint32_t firstIndex, uint32_t* visible)
+{
+	//each plane component broadcast to every lane once
+	__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+	for (int p = 0; p < 6; p++) {
+		planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+		planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+		planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+		planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+	}
+
+	const float* data = reinterpret_cast<const float*>(spheres);
+	uint32_t visibleCount = 0;
+	uint32_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		//4 spheres in, one register per component out
+		__m128 x = _mm_loadu_ps(data + i * 4);
+		__m128 y = _mm_loadu_ps(data + i * 4 + 4);
+		__m128 z = _mm_loadu_ps(data + i * 4 + 8);
+		__m128 radius = _mm_loadu_ps(data + i * 4 + 12);
+		_MM_TRANSPOSE4_PS(x, y, z, radius);
+
+		__m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), radius);
+
+		//same test as sphere_in_frustum: outside if the distance to any plane is below -radius
+		__m128 outside = _mm_setzero_ps();
+		for (int p = 0; p < 6; p++) {
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, planeX[p]), _mm_mul_ps(y, planeY[p])),
+				_mm_add_ps(_mm_mul_ps(z, planeZ[p]), planeW[p]));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, negRadius));
+		}
+
+		uint32_t inside = ~(uint32_t)_mm_movemask_ps(outside);
+		for (uint32_t lane = 0; lane < 4; lane++) {
+			visible[visibleCount] = firstIndex + i + lane;
+			visibleCount += (inside >> lane) & 1;
+		}
+	}
+
+	return visibleCount + cull_spheres_scalar(frustum, spheres + i, count - i, firstIndex + i, visible + visibleCount);
+}
+#endif
+
+#if VK_CULLING_AVX
+uint32_t cull_spheres_avx(const Frustum& frustum, const glm::vec4* spheres, uint32_t count, uint32_t firstIndex, uint32_t* visible)
+{
+	__m256 planeX[6], planeY[6], planeZ[6], planeW[6];
+	for (int p = 0; p < 6; p++) {
+		planeX[p] = _mm256_set1_ps(frustum.planes[p].x);
+		planeY[p] = _mm256_set1_ps(frustum.planes[p].y);
+		planeZ[p] = _mm256_set1_ps(frustum.planes[p].z);
+		planeW[p] = _mm256_set1_ps(frustum.planes[p].w);
+	}
+
+	const float* data = reinterpret_cast<const float*>(spheres);
+	uint32_t visibleCount = 0;
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		//two 4x4 transposes, the second group of 4 spheres goes to the upper lanes
+		__m128 x0 = _mm_loadu_ps(data + i * 4);
+		__m128 y0 = _mm_loadu_ps(data + i * 4 + 4);
+		__m128 z0 = _mm_loadu_ps(data + i * 4 + 8);
+		__m128 r0 = _mm_loadu_ps(data + i * 4 + 12);
+		_MM_TRANSPOSE4_PS(x0, y0, z0, r0);
+
+		__m128 x1 = _mm_loadu_ps(data + i * 4 + 16);
+		__m128 y1 = _mm_loadu_ps(data + i * 4 + 20);
+		__m128 z1 = _mm_loadu_ps(data + i * 4 + 24);
+		__m128 r1 = _mm_loadu_ps(data + i * 4 + 28);
+		_MM_TRANSPOSE4_PS(x1, y1, z1, r1);
+
+		__m256 x = _mm256_insertf128_ps(_mm256_castps128_ps256(x0), x1, 1);
+		__m256 y = _mm256_insertf128_ps(_mm256_castps128_ps256(y0), y1, 1);
+		__m256 z = _mm256_insertf128_ps(_mm256_castps128_ps256(z0), z1, 1);
+		__m256 radius = _mm256_insertf128_ps(_mm256_castps128_ps256(r0), r1, 1);
+
+		__m256 negRadius = _mm256_sub_ps(_mm256_setzero_ps(), radius);
+
+		__m256 outside = _mm256_setzero_ps();
+		for (int p = 0; p < 6; p++) {
+			__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, planeX[p]), _mm256_mul_ps(y, planeY[p])),
+				_mm256_add_ps(_mm256_mul_ps(z, planeZ[p]), planeW[p]));
+			outside = _mm256_or_ps(outside, _mm256_cmp_ps(distance, negRadius, _CMP_LT_OQ));
+		}
+
+		uint32_t inside = ~(uint32_t)_mm256_movemask_ps(outside);
+		for (uint32_t lane = 0; lane < 8; lane++) {
+			visible[visibleCount] = firstIndex + i + lane;
+			visibleCount += (inside >> lane) & 1;
+		}
+	}
+
+	//the last up to 7 go through SSE and scalar
+	return visibleCount + cull_spheres_sse(frustum, spheres + i, count - i, firstIndex + i, visible + visibleCount);
+}
+#endif
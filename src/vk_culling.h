@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+
+//batched sphere culling uses SSE on every x86-64 build, and AVX when the compiler targets it (VK_CULLING_AVX in CMake)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VK_CULLING_SSE 1
+#endif
+#if defined(__AVX__)
+#define VK_CULLING_AVX 1
+#endif
+
+
+//the six planes of a view frustum, pointing inwards. xyz is the normal, w the distance
+struct Frustum {
+	glm::vec4 planes[6];
+};
+
+//extracts the planes from a view-projection matrix (Gribb/Hartmann), normalized so plane distances are in world units
+Frustum make_frustum(const glm::mat4& viewProjection);
+
+//true if the sphere is at least partially inside the frustum
+bool sphere_in_frustum(const Frustum& frustum, const glm::vec3& center, float radius);
+
+//tests count spheres (xyz center, w radius) against the frustum, with the same result as sphere_in_frustum.
+//The indices of the ones at least partially inside, offset by firstIndex, are packed into visible, which needs
+//room for count indices. Returns how many were written. Uses the widest of the versions below that was compiled in
+uint32_t cull_spheres(const Frustum& frustum, const glm::vec4* spheres, uint32_t count, uint32_t firstIndex, uint32_t* visible);
+
+//"AVX", "SSE" or "scalar", whichever cull_spheres uses
+const char* cull_spheres_instruction_set();
+
+uint32_t cull_spheres_scalar(const Frustum& frustum, const glm::vec4* spheres, uint32_t count, uint32_t firstIndex, uint32_t* visible);
+
+#if VK_CULLING_SSE
+//4 spheres at a time
+uint32_t cull_spheres_sse(const Frustum& frustum, const glm::vec4* spheres, uint32_t count, uint32_t firstIndex, uint32_t* visible);
+#endif
+
+#if VK_CULLING_AVX
+//8 spheres at a time
+uint32_t cull_spheres_avx(const Frustum& frustum, const glm::vec4* spheres, uint32_t count, uint32_t firstIndex, uint32_t* visible);
+#endif
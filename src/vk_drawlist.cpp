@@ -0,0 +1,251 @@
+#include "vk_drawlist.h"
+
+#include <algorithm>
+
+
+DrawStats& DrawStats::operator+=(const DrawStats& other)
+{
+	objects += other.objects;
+	drawCalls += other.drawCalls;
+	instancedDraws += other.instancedDraws;
+	pipelineBinds += other.pipelineBinds;
+	vertexBufferBinds += other.vertexBufferBinds;
+	return *this;
+}
+
+
+uint16_t drawkey::depth_bucket(float distance, float zNear, float zFar)
+{
+	float normalized = (distance - zNear) / (zFar - zNear);
+	normalized = std::min(std::max(normalized, 0.f), 1.f);
+	return (uint16_t)(normalized * 65535.f);
+}
+
+
+void DrawList::build(const RenderObject* objects, uint32_t count, const glm::mat4& view, float zNear, float zFar)
+{
+	_objects = objects;
+
+	_keys.resize(count);
+	_indices.resize(count);
+
+	uint32_t drawable = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		const RenderObject& object = objects[i];
+
+		//objects of a material that is still compiling are keyed as its fallback, so they batch with it
+		const Material* material = drawable_material(object.material);
+		if (!material) {
+			continue;
+		}
+
+		//empty meshes were never uploaded, there is nothing to bind or draw
+		if (!object.mesh->_geometry.block) {
+			continue;
+		}
+
+		//view space depth of the object origin. The camera looks down -Z
+		glm::vec4 viewPos = view * object.transformMatrix[3];
+		uint16_t depth = drawkey::depth_bucket(-viewPos.z, zNear, zFar);
+
+		_keys[drawable] = drawkey::make(material->pipelineId, material->materialId, object.mesh->_meshId, depth);
+		_indices[drawable] = i;
+		drawable++;
+	}
+
+	_keys.resize(drawable);
+	_indices.resize(drawable);
+	count = drawable;
+
+	radix_sort();
+
+	//sorting put objects with the same material and mesh next to each other
+	_batches.clear();
+	for (uint32_t i = 0; i < count; i++) {
+		if (i == 0 || (_keys[i] & drawkey::BATCH_MASK) != (_keys[i - 1] & drawkey::BATCH_MASK)) {
+			_batches.push_back({ i, 0 });
+		}
+		_batches.back().count++;
+	}
+}
+
+void DrawList::write_instances(InstanceData* out) const
+{
+	for (uint32_t i = 0; i < size(); i++) {
+		out[i].model = get(i).transformMatrix;
+	}
+}
+
+uint32_t DrawList::batch_draws(const DrawBatch& batch) const
+{
+	return drawable_material(get(batch.first).material)->instancedPipeline != VK_NULL_HANDLE ? 1 : batch.count;
+}
+
+void DrawList::split_batches(uint32_t maxChunks, uint32_t minDrawsPerChunk, std::vector<uint32_t>& boundaries) const
+{
+	boundaries.clear();
+	boundaries.push_back(0);
+
+	uint32_t totalDraws = 0;
+	for (const DrawBatch& batch : _batches) {
+		totalDraws += batch_draws(batch);
+	}
+
+	//0 for either would divide by zero or wrap around below
+	minDrawsPerChunk = std::max(minDrawsPerChunk, 1u);
+	maxChunks = std::max(maxChunks, 1u);
+
+	uint32_t chunkCount = totalDraws / minDrawsPerChunk + (totalDraws % minDrawsPerChunk != 0 ? 1 : 0);
+	chunkCount = std::min(std::max(chunkCount, 1u), maxChunks);
+	uint32_t drawsPerChunk = (totalDraws + chunkCount - 1) / chunkCount;
+
+	//batches are never split, so a chunk can run over its share by up to one batch
+	uint32_t chunkDraws = 0;
+	for (uint32_t i = 0; i < (uint32_t)_batches.size(); i++) {
+		chunkDraws += batch_draws(_batches[i]);
+		if (chunkDraws >= drawsPerChunk && boundaries.size() < chunkCount) {
+			boundaries.push_back(i + 1);
+			chunkDraws = 0;
+		}
+	}
+
+	if (boundaries.back() != (uint32_t)_batches.size()) {
+		boundaries.push_back((uint32_t)_batches.size());
+	}
+}
+
+void DrawList::radix_sort()
+{
+	uint32_t count = (uint32_t)_keys.size();
+	if (count < 2) {
+		return;
+	}
+
+	_keysScratch.resize(count);
+	_indicesScratch.resize(count);
+
+	//histograms of all 8 digits in a single read of the keys
+	uint32_t histograms[8][256] = {};
+	for (uint32_t i = 0; i < count; i++) {
+		uint64_t key = _keys[i];
+		for (uint32_t pass = 0; pass < 8; pass++) {
+			histograms[pass][(key >> (pass * 8)) & 0xFF]++;
+		}
+	}
+
+	uint64_t* keysIn = _keys.data();
+	uint64_t* keysOut = _keysScratch.data();
+	uint32_t* indicesIn = _indices.data();
+	uint32_t* indicesOut = _indicesScratch.data();
+
+	for (uint32_t pass = 0; pass < 8; pass++) {
+		uint32_t* histogram = histograms[pass];
+		uint32_t shift = pass * 8;
+
+		//every key has the same digit here, the pass wouldn't move anything
+		if (histogram[(keysIn[0] >> shift) & 0xFF] == count) {
+			continue;
+		}
+
+		//turn counts into starting offsets
+		uint32_t offset = 0;
+		for (uint32_t digit = 0; digit < 256; digit++) {
+			uint32_t digitCount = histogram[digit];
+			histogram[digit] = offset;
+			offset += digitCount;
+		}
+
+		for (uint32_t i = 0; i < count; i++) {
+			uint32_t destination = histogram[(keysIn[i] >> shift) & 0xFF]++;
+			keysOut[destination] = keysIn[i];
+			indicesOut[destination] = indicesIn[i];
+		}
+
+		std::swap(keysIn, keysOut);
+		std::swap(indicesIn, indicesOut);
+	}
+
+	//an odd number of passes leaves the result in the scratch buffers
+	if (keysIn != _keys.data()) {
+		_keys.swap(_keysScratch);
+		_indices.swap(_indicesScratch);
+	}
+}
+
+DrawStats DrawList::record(VkCommandBuffer cmd, uint32_t begin, uint32_t end, const glm::mat4& viewProjection, VkBuffer instanceBuffer) const
+{
+	DrawStats stats;
+
+	VkPipeline lastPipeline = VK_NULL_HANDLE;
+	const GeometryBlock* lastBlock = nullptr;
+	bool instanceBufferBound = false;
+
+	for (uint32_t b = begin; b < end; b++) {
+		const DrawBatch& batch = _batches[b];
+		const RenderObject& first = get(batch.first);
+		const Material* material = drawable_material(first.material);
+
+		bool instanced = material->instancedPipeline != VK_NULL_HANDLE;
+		VkPipeline pipeline = instanced ? material->instancedPipeline : material->pipeline;
+
+		//only bind the pipeline if it doesn't match with the already bound one
+		if (pipeline != lastPipeline) {
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+			lastPipeline = pipeline;
+			stats.pipelineBinds++;
+		}
+
+		//meshes share the buffers of their geometry block, so only a block change needs a bind
+		const GeometryAllocation& geometry = first.mesh->_geometry;
+		if (geometry.block != lastBlock) {
+			VkDeviceSize offset = 0;
+			vkCmdBindVertexBuffers(cmd, 0, 1, &geometry.block->_vertexBuffer._buffer, &offset);
+			vkCmdBindIndexBuffer(cmd, geometry.block->_indexBuffer._buffer, 0, VK_INDEX_TYPE_UINT32);
+			lastBlock = geometry.block;
+			stats.vertexBufferBinds++;
+		}
+
+		if (instanced) {
+			//the instance stream is the same for the whole frame, batches pick their range through firstInstance
+			if (!instanceBufferBound) {
+				VkDeviceSize offset = 0;
+				vkCmdBindVertexBuffers(cmd, 1, 1, &instanceBuffer, &offset);
+				instanceBufferBound = true;
+				stats.vertexBufferBinds++;
+			}
+
+			//the per-object model matrices come from the instance buffer, so only the camera is pushed
+			MeshPushConstants constants;
+			constants.data = first.mesh->_dequantization;
+			constants.render_matrix = viewProjection;
+			vkCmdPushConstants(cmd, material->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+
+			vkCmdDrawIndexed(cmd, geometry.indexCount, batch.count, geometry.firstIndex, geometry.firstVertex, batch.first);
+			stats.drawCalls++;
+			if (batch.count > 1) {
+				stats.instancedDraws++;
+			}
+			continue;
+		}
+
+		for (uint32_t i = batch.first; i < batch.first + batch.count; i++) {
+			const RenderObject& object = get(i);
+
+			//final render matrix, that we are calculating on the cpu
+			MeshPushConstants constants;
+			constants.data = object.mesh->_dequantization;
+			constants.render_matrix = viewProjection * object.transformMatrix;
+
+			//upload the mesh to the GPU via push constants
+			vkCmdPushConstants(cmd, material->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+
+			vkCmdDrawIndexed(cmd, geometry.indexCount, 1, geometry.firstIndex, geometry.firstVertex, 0);
+			stats.drawCalls++;
+		}
+	}
+
+	for (uint32_t b = begin; b < end; b++) {
+		stats.objects += _batches[b].count;
+	}
+	return stats;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <vk_types.h>
+#include <vector>
+#include <glm/glm.hpp>
+#include "vk_gameobject.h"
+
+
+//how much work recording a frame's draws took
+struct DrawStats {
+	uint32_t objects{ 0 };
+	uint32_t drawCalls{ 0 };
+	//draws that covered more than one object
+	uint32_t instancedDraws{ 0 };
+	uint32_t pipelineBinds{ 0 };
+	uint32_t vertexBufferBinds{ 0 };
+
+	DrawStats& operator+=(const DrawStats& other);
+};
+
+//sort keys pack (pipeline, material, mesh, depth) into 64 bits, most significant first.
+//Sorting by them puts every object of a pipeline together, then every object of a material and mesh inside that,
+//so each of those is bound once. Inside a (material, mesh) group objects are front to back for early depth rejection
+namespace drawkey {
+	constexpr uint32_t PIPELINE_SHIFT = 48;
+	constexpr uint32_t MATERIAL_SHIFT = 32;
+	constexpr uint32_t MESH_SHIFT = 16;
+	constexpr uint32_t DEPTH_SHIFT = 0;
+
+	inline uint64_t make(uint16_t pipeline, uint16_t material, uint16_t mesh, uint16_t depth)
+	{
+		return ((uint64_t)pipeline << PIPELINE_SHIFT) | ((uint64_t)material << MATERIAL_SHIFT) | ((uint64_t)mesh << MESH_SHIFT) | ((uint64_t)depth << DEPTH_SHIFT);
+	}
+
+	//maps a view space distance to 16 bits, nearest first
+	uint16_t depth_bucket(float distance, float zNear, float zFar);
+
+	//everything above the depth bits. Objects with equal batch keys share material and mesh
+	constexpr uint64_t BATCH_MASK = ~0xFFFFull;
+}
+
+//a run of sorted objects with the same material and mesh
+struct DrawBatch {
+	uint32_t first;
+	uint32_t count;
+};
+
+//the frame's renderables in sort key order
+class DrawList {
+public:
+
+	//computes the key of every object, radix sorts them and splits them into batches.
+	//The objects have to outlive the draw list's use this frame
+	void build(const RenderObject* objects, uint32_t count, const glm::mat4& view, float zNear, float zFar);
+
+	uint32_t size() const { return (uint32_t)_indices.size(); }
+
+	const RenderObject& get(uint32_t i) const { return _objects[_indices[i]]; }
+
+	uint64_t key(uint32_t i) const { return _keys[i]; }
+
+	uint32_t batch_count() const { return (uint32_t)_batches.size(); }
+
+	const DrawBatch& batch(uint32_t i) const { return _batches[i]; }
+
+	//writes the per-instance data of every object in sorted order, so a batch's instances start at batch.first
+	void write_instances(InstanceData* out) const;
+
+	//splits the batches into at most maxChunks contiguous ranges of roughly equal recording cost, none cheaper than
+	//minDrawsPerChunk draws unless it is the only one. boundaries receives chunkCount + 1 batch indices. 0 for either
+	//argument is treated as 1
+	void split_batches(uint32_t maxChunks, uint32_t minDrawsPerChunk, std::vector<uint32_t>& boundaries) const;
+
+	//records the batches [begin, end), only binding a pipeline or vertex buffer when it differs from the previous draw.
+	//Batches whose material has an instanced pipeline become a single draw reading transforms from instanceBuffer
+	DrawStats record(VkCommandBuffer cmd, uint32_t begin, uint32_t end, const glm::mat4& viewProjection, VkBuffer instanceBuffer) const;
+
+private:
+
+	//how many draw calls recording a batch costs
+	uint32_t batch_draws(const DrawBatch& batch) const;
+
+	//LSD radix sort of _keys, carrying _indices along. Byte passes where every key has the same digit are skipped
+	void radix_sort();
+
+	const RenderObject* _objects{ nullptr };
+
+	std::vector<uint64_t> _keys;
+	std::vector<uint32_t> _indices;
+	std::vector<DrawBatch> _batches;
+
+	//ping-pong buffers for the sort, kept around so steady state frames don't allocate
+	std::vector<uint64_t> _keysScratch;
+	std::vector<uint32_t> _indicesScratch;
+};
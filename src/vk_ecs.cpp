@@ -0,0 +1,59 @@
+#include "vk_ecs.h"
+
+#include <atomic>
+
+
+uint32_t next_component_type_index()
+{
+	static std::atomic<uint32_t> next{ 0 };
+	return next.fetch_add(1);
+}
+
+Entity Registry::create()
+{
+	Entity entity;
+	if (!_freeIndices.empty()) {
+		entity.index = _freeIndices.back();
+		_freeIndices.pop_back();
+	}
+	else {
+		entity.index = (uint32_t)_generations.size();
+		_generations.push_back(1);
+		_alive.push_back(0);
+	}
+
+	entity.generation = _generations[entity.index];
+	_alive[entity.index] = 1;
+	_aliveCount++;
+	_structureVersion++;
+	return entity;
+}
+
+void Registry::destroy(Entity entity)
+{
+	if (!is_alive(entity)) {
+		return;
+	}
+
+	for (std::unique_ptr<ComponentPoolBase>& pool : _pools) {
+		if (pool) {
+			pool->remove(entity);
+		}
+	}
+
+	//handles to it stop matching, the index is free for the next entity
+	_generations[entity.index]++;
+	_alive[entity.index] = 0;
+	_freeIndices.push_back(entity.index);
+	_aliveCount--;
+	_structureVersion++;
+}
+
+void Registry::clear()
+{
+	for (uint32_t index = 0; index < _generations.size(); index++) {
+		if (_alive[index]) {
+			destroy(Entity{ index, _generations[index] });
+		}
+	}
+}
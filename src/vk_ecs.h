@@ -0,0 +1,197 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+//an id with a generation, so an entity that was destroyed is told apart from a later one reusing its index
+struct Entity {
+	uint32_t index{ UINT32_MAX };
+	uint32_t generation{ 0 };
+
+	bool operator==(const Entity& other) const { return index == other.index && generation == other.generation; }
+	bool operator!=(const Entity& other) const { return !(*this == other); }
+};
+
+//the same for every T in the program, assigned the first time a component type is used
+uint32_t next_component_type_index();
+
+template<typename T>
+uint32_t component_type_index()
+{
+	static const uint32_t index = next_component_type_index();
+	return index;
+}
+
+//lets the registry drop an entity's components without knowing their types
+class ComponentPoolBase {
+public:
+	virtual ~ComponentPoolBase() = default;
+	virtual void remove(Entity entity) = 0;
+	virtual bool contains(Entity entity) const = 0;
+};
+
+//sparse set of one component type. The components are packed in a dense array, with a parallel array of their
+//entities, and a sparse array indexed by entity index points into both. Lookups are O(1), and iterating touches
+//only packed memory. Removing moves the last component into the hole, so the dense order isn't stable
+template<typename T>
+class ComponentPool : public ComponentPoolBase {
+public:
+	//replaces the component if the entity already has one
+	T& add(Entity entity, const T& component)
+	{
+		if (entity.index >= _sparse.size()) {
+			_sparse.resize(entity.index + 1, UINT32_MAX);
+		}
+
+		uint32_t dense = _sparse[entity.index];
+		if (dense != UINT32_MAX) {
+			_entities[dense] = entity;
+			_components[dense] = component;
+			return _components[dense];
+		}
+
+		_sparse[entity.index] = (uint32_t)_components.size();
+		_entities.push_back(entity);
+		_components.push_back(component);
+		return _components.back();
+	}
+
+	void remove(Entity entity) override
+	{
+		if (!contains(entity)) {
+			return;
+		}
+
+		uint32_t dense = _sparse[entity.index];
+		uint32_t last = (uint32_t)_components.size() - 1;
+		if (dense != last) {
+			_components[dense] = std::move(_components[last]);
+			_entities[dense] = _entities[last];
+			_sparse[_entities[dense].index] = dense;
+		}
+
+		_components.pop_back();
+		_entities.pop_back();
+		_sparse[entity.index] = UINT32_MAX;
+	}
+
+	bool contains(Entity entity) const override
+	{
+		return entity.index < _sparse.size() && _sparse[entity.index] != UINT32_MAX
+			&& _entities[_sparse[entity.index]].generation == entity.generation;
+	}
+
+	//nullptr if the entity doesn't have one
+	T* get(Entity entity) { return contains(entity) ? &_components[_sparse[entity.index]] : nullptr; }
+	const T* get(Entity entity) const { return contains(entity) ? &_components[_sparse[entity.index]] : nullptr; }
+
+	uint32_t size() const { return (uint32_t)_components.size(); }
+
+	//the packed arrays, both size() long and in the same order
+	T* data() { return _components.data(); }
+	const T* data() const { return _components.data(); }
+	const Entity* entities() const { return _entities.data(); }
+
+private:
+	std::vector<uint32_t> _sparse;
+	std::vector<Entity> _entities;
+	std::vector<T> _components;
+};
+
+//owns the entities and one ComponentPool per component type. Not thread safe for structural changes,
+//but systems may read and write existing components from several threads, as long as each writes its own
+class Registry {
+public:
+	Entity create();
+
+	//removes every component of the entity. Does nothing for entities that are already gone
+	void destroy(Entity entity);
+
+	bool is_alive(Entity entity) const
+	{
+		return entity.index < _generations.size() && _generations[entity.index] == entity.generation && _alive[entity.index];
+	}
+
+	//destroys every entity. Their handles all become stale
+	void clear();
+
+	uint32_t entity_count() const { return _aliveCount; }
+
+	//changes whenever an entity or a component is added or removed, so caches built from the registry
+	//know when to rebuild. Changing a component's value doesn't count
+	uint64_t structure_version() const { return _structureVersion; }
+
+	template<typename T>
+	T& add(Entity entity, const T& component = T{})
+	{
+		_structureVersion++;
+		return pool<T>().add(entity, component);
+	}
+
+	template<typename T>
+	void remove(Entity entity)
+	{
+		_structureVersion++;
+		pool<T>().remove(entity);
+	}
+
+	template<typename T>
+	T* get(Entity entity) { return pool<T>().get(entity); }
+
+	template<typename T>
+	bool has(Entity entity) { return pool<T>().contains(entity); }
+
+	//created the first time it is asked for
+	template<typename T>
+	ComponentPool<T>& pool()
+	{
+		uint32_t type = component_type_index<T>();
+		if (type >= _pools.size()) {
+			_pools.resize(type + 1);
+		}
+		if (!_pools[type]) {
+			_pools[type] = std::make_unique<ComponentPool<T>>();
+		}
+		return *static_cast<ComponentPool<T>*>(_pools[type].get());
+	}
+
+	//fn(Entity, First&, Rest&...) for every entity that has all of the components. Walks the packed array of First,
+	//so the rarest component should go first. Components can't be added or removed from inside fn
+	template<typename First, typename... Rest, typename F>
+	void each(F&& fn)
+	{
+		ComponentPool<First>& first = pool<First>();
+		for (uint32_t i = 0; i < first.size(); i++) {
+			Entity entity = first.entities()[i];
+			if (all_present<Rest...>(entity)) {
+				fn(entity, first.data()[i], *pool<Rest>().get(entity)...);
+			}
+		}
+	}
+
+private:
+	template<typename... Ts>
+	bool all_present(Entity entity)
+	{
+		//the leading true keeps the array valid when Ts is empty
+		(void)entity;
+		bool present[] = { true, pool<Ts>().contains(entity)... };
+		for (bool p : present) {
+			if (!p) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	std::vector<std::unique_ptr<ComponentPoolBase>> _pools;
+
+	//per entity index
+	std::vector<uint32_t> _generations;
+	std::vector<uint8_t> _alive;
+	std::vector<uint32_t> _freeIndices;
+	uint32_t _aliveCount{ 0 };
+
+	uint64_t _structureVersion{ 0 };
+};
@@ -12,6 +12,10 @@
 
 #include <iostream>
 #include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <cassert>
 
 using namespace std::chrono;
 
@@ -26,39 +30,47 @@ using namespace std::chrono;
 
 #include <glm/gtx/transform.hpp>
 
+#include "vk_culling.h"
+#include "vk_render_systems.h"
+#include "vk_mesh_optimizer.h"
+
 
 
 
-//we want to immediately abort when there is an error. In normal engines this would give an error message to the user, or perform a dump of state.
 using namespace std;
-#define VK_CHECK(x)                                                 \
-	do                                                              \
-	{                                                               \
-		VkResult err = x;                                           \
-		if (err)                                                    \
-		{                                                           \
-			std::cout <<"Detected Vulkan error: " << err << std::endl; \
-			abort();                                                \
-		}                                                           \
-	} while (0)
 
 
 void VulkanEngine::init()
 {
-	// We initialize SDL and create a window with it. 
-	SDL_Init(SDL_INIT_VIDEO);
+	//only 1 to MAX_FRAMES_IN_FLIGHT frame slots exist
+	_framesInFlight = glm::clamp(_framesInFlight, 1u, MAX_FRAMES_IN_FLIGHT);
+
+	VK_TRACE_THREAD_NAME("main");
 
-	SDL_WindowFlags window_flags = (SDL_WindowFlags)(SDL_WINDOW_VULKAN);
+	//the main thread becomes job thread 0
+	_jobSystem.init(_jobThreads);
 
-	//create blank SDL window for our application
-	_window = SDL_CreateWindow(
-		"Vulkan Engine", //window title
-		SDL_WINDOWPOS_UNDEFINED, //window position x (don't care)
-		SDL_WINDOWPOS_UNDEFINED, //window position y (don't care)
-		_windowExtent.width,  //window width in pixels
-		_windowExtent.height, //window height in pixels
-		window_flags
-	);
+	if (_recordingThreads == 0) {
+		_recordingThreads = _jobSystem.thread_count();
+	}
+	_recordingThreads = glm::clamp(_recordingThreads, 1u, MAX_RECORDING_THREADS);
+
+	// We initialize SDL and create a window with it. Headless runs never touch SDL
+	if (!_headless) {
+		SDL_Init(SDL_INIT_VIDEO);
+
+		SDL_WindowFlags window_flags = (SDL_WindowFlags)(SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
+
+		//create blank SDL window for our application
+		_window = SDL_CreateWindow(
+			"Vulkan Engine", //window title
+			SDL_WINDOWPOS_UNDEFINED, //window position x (don't care)
+			SDL_WINDOWPOS_UNDEFINED, //window position y (don't care)
+			_windowExtent.width,  //window width in pixels
+			_windowExtent.height, //window height in pixels
+			window_flags
+		);
+	}
 
 	//load the core Vulkan structures
 	init_vulkan();
@@ -71,7 +83,18 @@ void VulkanEngine::init()
 
 	init_framebuffers();
 	init_sync_structures();
+	init_descriptors();
+	init_pipeline_cache();
+
+	//compare across runs to see what the pipeline cache saves
+	auto pipelineStart = high_resolution_clock::now();
 	init_pipelines();
+	auto pipelineTime = duration_cast<microseconds>(high_resolution_clock::now() - pipelineStart);
+	std::cout << "Pipelines built in " << pipelineTime.count() / 1000.f << " ms (" << (_pipelineCacheWarm ? "warm" : "cold") << " pipeline cache)" << std::endl;
+
+	PipelineStateStats pipelineStats = _pipelineStates.stats();
+	std::cout << "Pipeline states: " << _pipelineStates.size() << " pipelines, " << pipelineStats.hits << " hits, " << pipelineStats.misses << " misses" << std::endl;
+
 	load_meshes();
 	init_scene();
 	cameraRotationTransform = glm::mat4(1.0f);
@@ -105,18 +128,25 @@ void VulkanEngine::init_scene()
 		}
 	}
 	*/
-	RenderObject monkey;
-	monkey.mesh = get_mesh("monkey");
-	monkey.material = get_material("defaultmesh");
-	
-	GameObject monkeyGO;
-	monkeyGO.renderObject = monkey;
-	monkeyGO.parent = nullptr;
-	monkeyGO.move_object(glm::mat4{ 1.0f });
-	gameObjects[gameObjectsIndex] = monkeyGO;
-	add_to_root(monkeyGO);
+	Mesh* monkeyMesh = get_mesh("monkey");
+	//compact meshes need the material built for their vertex layout
+	Material* monkeyMaterial = get_material(monkeyMesh->_vertexFormat == VertexFormat::Compact ? "defaultmesh_compact" : "defaultmesh");
+
+	//the monkey sits in the transform hierarchy, so it can be moved and have children
+	create_game_object(monkeyMesh, monkeyMaterial);
 
+	//the triangle grid all shares one mesh and material, so it collapses into a single instanced draw
+	Mesh* triangleMesh = get_mesh("triangle");
+	Material* triangleMaterial = get_material("defaultmesh");
+	for (int x = -20; x <= 20; x++) {
+		for (int y = -20; y <= 20; y++) {
+
+			glm::mat4 translation = glm::translate(glm::mat4{ 1.0 }, glm::vec3(x, 0, y));
+			glm::mat4 scale = glm::scale(glm::mat4{ 1.0 }, glm::vec3(0.2, 0.2, 0.2));
 
+			create_renderable(triangleMesh, triangleMaterial, translation * scale);
+		}
+	}
 }
 
 
@@ -125,11 +155,12 @@ void VulkanEngine::init_vulkan()
 {
 	vkb::InstanceBuilder builder;
 
-	//make the Vulkan instance, with basic debug features
+	//make the Vulkan instance, with basic debug features. Headless instances don't enable the surface extensions
 	auto inst_ret = builder.set_app_name("Example Vulkan Application")
 		.request_validation_layers(true)
 		.require_api_version(1, 1, 0)
 		.use_default_debug_messenger()
+		.set_headless(_headless)
 		.build();
 
 	vkb::Instance vkb_inst = inst_ret.value();
@@ -144,18 +175,38 @@ void VulkanEngine::init_vulkan()
 
 
 
-	// get the surface of the window we opened with SDL
-	SDL_Vulkan_CreateSurface(_window, _instance, &_surface);
-
 	//use vkbootstrap to select a GPU.
 	//We want a GPU that can write to the SDL surface and supports Vulkan 1.1
 	vkb::PhysicalDeviceSelector selector{ vkb_inst };
+	selector.set_minimum_version(1, 1);
+
+	if (_headless) {
+		//no surface and no swapchain extension. Any device type is fine, CI machines only have CPU implementations
+		selector.require_present(false)
+			.allow_any_gpu_device_type(true);
+	}
+	else {
+		// get the surface of the window we opened with SDL
+		SDL_Vulkan_CreateSurface(_window, _instance, &_surface);
+		selector.set_surface(_surface);
+	}
+
 	vkb::PhysicalDevice physicalDevice = selector
-		.set_minimum_version(1, 1)
-		.set_surface(_surface)
 		.select()
 		.value();
 
+	//the GPU-driven path needs objects to be found through firstInstance in indirect draws.
+	//Multi-draw and indirect count draws are optional, it falls back to fewer or uncompacted draws without them
+	VkPhysicalDeviceFeatures firstInstanceFeatures = {};
+	firstInstanceFeatures.drawIndirectFirstInstance = VK_TRUE;
+	_gpuDrivenSupported = physicalDevice.enable_features_if_present(firstInstanceFeatures);
+
+	VkPhysicalDeviceFeatures multiDrawFeatures = {};
+	multiDrawFeatures.multiDrawIndirect = VK_TRUE;
+	_multiDrawIndirectSupported = physicalDevice.enable_features_if_present(multiDrawFeatures);
+
+	bool drawIndirectCountSupported = physicalDevice.enable_extension_if_present(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+
 	//create the final Vulkan device
 	vkb::DeviceBuilder deviceBuilder{ physicalDevice };
 
@@ -165,10 +216,31 @@ void VulkanEngine::init_vulkan()
 	_device = vkbDevice.device;
 	_chosenGPU = physicalDevice.physical_device;
 
+	if (drawIndirectCountSupported) {
+		_vkCmdDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(_device, "vkCmdDrawIndexedIndirectCountKHR");
+	}
+
 	// use vkbootstrap to get a Graphics queue
 	_graphicsQueue = vkbDevice.get_queue(vkb::QueueType::graphics).value();
 	_graphicsQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::graphics).value();
 
+	//uploads prefer a transfer-only queue, which maps to the copy engine on most discrete GPUs.
+	//Then any queue family other than graphics, and the graphics queue itself as the last resort
+	auto dedicatedTransfer = vkbDevice.get_dedicated_queue(vkb::QueueType::transfer);
+	auto separateTransfer = vkbDevice.get_queue(vkb::QueueType::transfer);
+	if (dedicatedTransfer.has_value()) {
+		_transferQueue = dedicatedTransfer.value();
+		_transferQueueFamily = vkbDevice.get_dedicated_queue_index(vkb::QueueType::transfer).value();
+	}
+	else if (separateTransfer.has_value()) {
+		_transferQueue = separateTransfer.value();
+		_transferQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::transfer).value();
+	}
+	else {
+		_transferQueue = _graphicsQueue;
+		_transferQueueFamily = _graphicsQueueFamily;
+	}
+
 
 	//initialize the memory allocator
 	VmaAllocatorCreateInfo allocatorInfo = {};
@@ -177,31 +249,48 @@ void VulkanEngine::init_vulkan()
 	allocatorInfo.instance = _instance;
 	vmaCreateAllocator(&allocatorInfo, &_allocator);
 
+	//blocks are created on the first upload that needs them
+	_geometryPool.init(_allocator, sizeof(Vertex), GEOMETRY_BLOCK_VERTICES, GEOMETRY_BLOCK_INDICES);
+	_compactGeometryPool.init(_allocator, sizeof(CompactVertex), GEOMETRY_BLOCK_VERTICES, GEOMETRY_BLOCK_INDICES);
+
+	_mainDeletionQueue.push_function([=]() {
+		_geometryPool.destroy();
+		_compactGeometryPool.destroy();
+		});
+
 }
 
 
 void VulkanEngine::init_swapchain()
 {
-	vkb::SwapchainBuilder swapchainBuilder{ _chosenGPU,_device,_surface };
-
-	vkb::Swapchain vkbSwapchain = swapchainBuilder
-		.use_default_format_selection()
-		//use vsync present mode
-		.set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
-		.set_desired_extent(_windowExtent.width, _windowExtent.height)
-		.build()
-		.value();
+	if (_headless) {
+		init_offscreen_targets();
+	}
+	else {
+		vkb::SwapchainBuilder swapchainBuilder{ _chosenGPU,_device,_surface };
 
-	//store swapchain and its related images
-	_swapchain = vkbSwapchain.swapchain;
-	_swapchainImages = vkbSwapchain.get_images().value();
-	_swapchainImageViews = vkbSwapchain.get_image_views().value();
+		vkb::Swapchain vkbSwapchain = swapchainBuilder
+			.use_default_format_selection()
+			//use vsync present mode
+			.set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
+			.set_desired_extent(_windowExtent.width, _windowExtent.height)
+			.build()
+			.value();
 
-	_swapchainImageFormat = vkbSwapchain.image_format;
+		//store swapchain and its related images
+		_swapchain = vkbSwapchain.swapchain;
+		_swapchainImages = vkbSwapchain.get_images().value();
+		_swapchainImageViews = vkbSwapchain.get_image_views().value();
 
-	_mainDeletionQueue.push_function([=]() {
-		vkDestroySwapchainKHR(_device, _swapchain, nullptr);
-		});
+		_swapchainImageFormat = vkbSwapchain.image_format;
+
+		//the surface may not allow the size we asked for, everything else follows what we got
+		_windowExtent = vkbSwapchain.extent;
+
+		_swapchainDeletionQueue.push_function([=]() {
+			vkDestroySwapchainKHR(_device, _swapchain, nullptr);
+			});
+	}
 
 	//depth image size will match the window
 	VkExtent3D depthImageExtent = {
@@ -230,7 +319,7 @@ void VulkanEngine::init_swapchain()
 	VK_CHECK(vkCreateImageView(_device, &dview_info, nullptr, &_depthImageView));
 
 	//add to deletion queues
-	_mainDeletionQueue.push_function([=]() {
+	_swapchainDeletionQueue.push_function([=]() {
 		vkDestroyImageView(_device, _depthImageView, nullptr);
 		vmaDestroyImage(_allocator, _depthImage._image, _depthImage._allocation);
 		});
@@ -238,19 +327,116 @@ void VulkanEngine::init_swapchain()
 
 }
 
+void VulkanEngine::init_offscreen_targets()
+{
+	//one target per frame in flight, so a frame never renders into an image the GPU may still be writing
+	_swapchainImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+
+	VkExtent3D extent = { _windowExtent.width, _windowExtent.height, 1 };
+
+	//transfer source so a frame can be read back to check the output
+	VkImageCreateInfo imageInfo = vkinit::image_create_info(_swapchainImageFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, extent);
+
+	VmaAllocationCreateInfo allocInfo = {};
+	allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+	_offscreenImages.resize(_framesInFlight);
+	_swapchainImages.resize(_framesInFlight);
+	_swapchainImageViews.resize(_framesInFlight);
+
+	for (uint32_t i = 0; i < _framesInFlight; i++) {
+		VK_CHECK(vmaCreateImage(_allocator, &imageInfo, &allocInfo, &_offscreenImages[i]._image, &_offscreenImages[i]._allocation, nullptr));
+		_swapchainImages[i] = _offscreenImages[i]._image;
+
+		VkImageViewCreateInfo viewInfo = vkinit::imageview_create_info(_swapchainImageFormat, _offscreenImages[i]._image, VK_IMAGE_ASPECT_COLOR_BIT);
+		VK_CHECK(vkCreateImageView(_device, &viewInfo, nullptr, &_swapchainImageViews[i]));
+	}
+
+	//the views are destroyed with the framebuffers
+	_swapchainDeletionQueue.push_function([=]() {
+		for (AllocatedImage& image : _offscreenImages) {
+			vmaDestroyImage(_allocator, image._image, image._allocation);
+		}
+		_offscreenImages.clear();
+		});
+}
+
 void VulkanEngine::init_commands(){
 	//create a command pool for commands submitted to the graphics queue.
+	//every frame in flight gets its own pool, so resetting one never touches a buffer the GPU may still be reading
 	VkCommandPoolCreateInfo commandPoolInfo = vkinit::command_pool_create_info(_graphicsQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
 
-	VK_CHECK(vkCreateCommandPool(_device, &commandPoolInfo, nullptr, &_commandPool));
+	for (uint32_t i = 0; i < _framesInFlight; i++) {
+
+		VK_CHECK(vkCreateCommandPool(_device, &commandPoolInfo, nullptr, &_frames[i]._commandPool));
+
+		VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::command_buffer_allocate_info(_frames[i]._commandPool, 1);
 
-	VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::command_buffer_allocate_info(_commandPool, 1);
+		VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &_frames[i]._mainCommandBuffer));
 
+		_mainDeletionQueue.push_function([=]() {
+			vkDestroyCommandPool(_device, _frames[i]._commandPool, nullptr);
+			});
+
+		//the instance buffer is created on first use and may be replaced as it grows, so destroy whatever it is at the end
+		_mainDeletionQueue.push_function([=]() {
+			if (_frames[i]._instanceCapacity > 0) {
+				vmaDestroyBuffer(_allocator, _frames[i]._instanceBuffer._buffer, _frames[i]._instanceBuffer._allocation);
+			}
+			});
+
+		//the recording pools are reset as a whole every frame, which is cheaper than resetting buffers one by one
+		VkCommandPoolCreateInfo recordPoolInfo = vkinit::command_pool_create_info(_graphicsQueueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+
+		for (uint32_t t = 0; t < _recordingThreads; t++) {
+
+			VK_CHECK(vkCreateCommandPool(_device, &recordPoolInfo, nullptr, &_frames[i]._recordPools[t]));
+
+			VkCommandBufferAllocateInfo secondaryAllocInfo = vkinit::command_buffer_allocate_info(_frames[i]._recordPools[t], 1, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+
+			VK_CHECK(vkAllocateCommandBuffers(_device, &secondaryAllocInfo, &_frames[i]._secondaryCommandBuffers[t]));
+
+			_mainDeletionQueue.push_function([=]() {
+				vkDestroyCommandPool(_device, _frames[i]._recordPools[t], nullptr);
+				});
+		}
+	}
+
+	//upload batches are recorded once and thrown away, their pools are reset whole before reuse.
+	//The copies run on the transfer queue, the ownership acquires on the graphics queue
+	VkCommandPoolCreateInfo uploadPoolInfo = vkinit::command_pool_create_info(_transferQueueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+	VkCommandPoolCreateInfo acquirePoolInfo = vkinit::command_pool_create_info(_graphicsQueueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+
+	for (uint32_t i = 0; i < UPLOAD_BATCHES; i++) {
+		UploadBatch& batch = _uploadContext._batches[i];
 
-	VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &_mainCommandBuffer));
+		VK_CHECK(vkCreateCommandPool(_device, &uploadPoolInfo, nullptr, &batch._commandPool));
+
+		VkCommandBufferAllocateInfo uploadAllocInfo = vkinit::command_buffer_allocate_info(batch._commandPool, 1);
+
+		VK_CHECK(vkAllocateCommandBuffers(_device, &uploadAllocInfo, &batch._commandBuffer));
+
+		VK_CHECK(vkCreateCommandPool(_device, &acquirePoolInfo, nullptr, &batch._acquirePool));
+
+		VkCommandBufferAllocateInfo acquireAllocInfo = vkinit::command_buffer_allocate_info(batch._acquirePool, 1);
+
+		VK_CHECK(vkAllocateCommandBuffers(_device, &acquireAllocInfo, &batch._acquireCommandBuffer));
+
+		_mainDeletionQueue.push_function([=]() {
+			vkDestroyCommandPool(_device, _uploadContext._batches[i]._commandPool, nullptr);
+			vkDestroyCommandPool(_device, _uploadContext._batches[i]._acquirePool, nullptr);
+			});
+	}
+
+	//the staging ring is written by the CPU and only read by transfers, and stays mapped for the whole run
+	_uploadContext._stagingBuffer = create_buffer(STAGING_BUFFER_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY, VMA_ALLOCATION_CREATE_MAPPED_BIT);
+
+	VmaAllocationInfo stagingInfo;
+	vmaGetAllocationInfo(_allocator, _uploadContext._stagingBuffer._allocation, &stagingInfo);
+	_uploadContext._stagingData = (uint8_t*)stagingInfo.pMappedData;
 
 	_mainDeletionQueue.push_function([=]() {
-		vkDestroyCommandPool(_device, _commandPool, nullptr);
+		vmaDestroyBuffer(_allocator, _uploadContext._stagingBuffer._buffer, _uploadContext._stagingBuffer._allocation);
 		});
 }
 
@@ -273,8 +459,9 @@ void VulkanEngine::init_default_renderpass()
 	//we don't know or care about the starting layout of the attachment
 	color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 
-	//after the renderpass ends, the image has to be on a layout ready for display
-	color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	//after the renderpass ends, the image has to be on a layout ready for display.
+	//Offscreen targets can't use the present layout without the swapchain extension, they are left ready to be copied from
+	color_attachment.finalLayout = _headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
 
 
@@ -356,7 +543,8 @@ void VulkanEngine::init_default_renderpass()
 	depth_dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
 	depth_dependency.dstSubpass = 0;
 	depth_dependency.srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
-	depth_dependency.srcAccessMask = 0;
+	//frames in flight share the one depth image, so the previous frame's depth writes must finish before ours start
+	depth_dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 	depth_dependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
 	depth_dependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
@@ -404,7 +592,7 @@ void VulkanEngine::init_framebuffers()
 
 		VK_CHECK(vkCreateFramebuffer(_device, &fb_info, nullptr, &_framebuffers[i]));
 
-		_mainDeletionQueue.push_function([=]() {
+		_swapchainDeletionQueue.push_function([=]() {
 			vkDestroyFramebuffer(_device, _framebuffers[i], nullptr);
 			vkDestroyImageView(_device, _swapchainImageViews[i], nullptr);
 			});
@@ -412,77 +600,191 @@ void VulkanEngine::init_framebuffers()
 
 }
 
+bool VulkanEngine::recreate_swapchain()
+{
+	int width = 0, height = 0;
+	SDL_Vulkan_GetDrawableSize(_window, &width, &height);
+	if (width == 0 || height == 0) {
+		return false;
+	}
+
+	//the old swapchain images may still be in use by frames in flight
+	VK_CHECK(vkDeviceWaitIdle(_device));
+
+	_swapchainDeletionQueue.flush();
+
+	_windowExtent.width = (uint32_t)width;
+	_windowExtent.height = (uint32_t)height;
+
+	//the surface format doesn't change with the size, so the render pass stays valid
+	init_swapchain();
+	init_framebuffers();
+
+	_resizeRequested = false;
+	return true;
+}
+
+void VulkanEngine::set_viewport(VkCommandBuffer cmd)
+{
+	VkViewport viewport = {};
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = (float)_windowExtent.width;
+	viewport.height = (float)_windowExtent.height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+
+	VkRect2D scissor = {};
+	scissor.offset = { 0, 0 };
+	scissor.extent = _windowExtent;
+
+	vkCmdSetViewport(cmd, 0, 1, &viewport);
+	vkCmdSetScissor(cmd, 0, 1, &scissor);
+}
+
 void VulkanEngine::init_sync_structures()
 {
+	//the fences start signalled so the first wait on each frame slot returns immediately
 	VkFenceCreateInfo fenceCreateInfo = vkinit::fence_create_info(VK_FENCE_CREATE_SIGNALED_BIT);
 
-	VK_CHECK(vkCreateFence(_device, &fenceCreateInfo, nullptr, &_renderFence));
+	VkSemaphoreCreateInfo semaphoreCreateInfo = vkinit::semaphore_create_info();
 
-	//enqueue the destruction of the fence
-	_mainDeletionQueue.push_function([=]() {
-		vkDestroyFence(_device, _renderFence, nullptr);
-		});
+	for (uint32_t i = 0; i < _framesInFlight; i++) {
 
-	VkSemaphoreCreateInfo semaphoreCreateInfo = vkinit::semaphore_create_info();
+		VK_CHECK(vkCreateFence(_device, &fenceCreateInfo, nullptr, &_frames[i]._renderFence));
 
-	VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_presentSemaphore));
-	VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_renderSemaphore));
+		//enqueue the destruction of the fence
+		_mainDeletionQueue.push_function([=]() {
+			vkDestroyFence(_device, _frames[i]._renderFence, nullptr);
+			});
+
+		VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_frames[i]._presentSemaphore));
+		VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_frames[i]._renderSemaphore));
+
+		//enqueue the destruction of semaphores
+		_mainDeletionQueue.push_function([=]() {
+			vkDestroySemaphore(_device, _frames[i]._presentSemaphore, nullptr);
+			vkDestroySemaphore(_device, _frames[i]._renderSemaphore, nullptr);
+			});
+	}
+
+	//signalled too, a batch waits on its fence before reusing its staging segment
+	for (uint32_t i = 0; i < UPLOAD_BATCHES; i++) {
+
+		VK_CHECK(vkCreateFence(_device, &fenceCreateInfo, nullptr, &_uploadContext._batches[i]._uploadFence));
+		VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_uploadContext._batches[i]._transferSemaphore));
+
+		_mainDeletionQueue.push_function([=]() {
+			vkDestroyFence(_device, _uploadContext._batches[i]._uploadFence, nullptr);
+			vkDestroySemaphore(_device, _uploadContext._batches[i]._transferSemaphore, nullptr);
+			});
+	}
+
+	//its queries are per frame slot, just like the fences above
+	_gpuProfiler.init(_device, _chosenGPU, _graphicsQueueFamily, _framesInFlight);
 
-	//enqueue the destruction of semaphores
 	_mainDeletionQueue.push_function([=]() {
-		vkDestroySemaphore(_device, _presentSemaphore, nullptr);
-		vkDestroySemaphore(_device, _renderSemaphore, nullptr);
+		_gpuProfiler.destroy();
 		});
-
 }
 
 void VulkanEngine::cleanup()
 {
 	if (_isInitialized) {
 
-		//make sure the GPU has stopped doing its things
-		vkWaitForFences(_device, 1, &_renderFence, true, 1000000000);
+		//make sure the GPU has stopped doing its things, on every frame that may still be in flight
+		for (uint32_t i = 0; i < _framesInFlight; i++) {
+			vkWaitForFences(_device, 1, &_frames[i]._renderFence, true, 1000000000);
+		}
+
+		//pipelines may still be compiling on the workers
+		_pipelineCompiler.wait_all();
+		_jobSystem.shutdown();
 
+		_swapchainDeletionQueue.flush();
 		_mainDeletionQueue.flush();
 		vmaDestroyAllocator(_allocator); //TODO: Place i nright place or put into deletion queue
 
-		vkDestroySurfaceKHR(_instance, _surface, nullptr);
+		if (!_headless) {
+			vkDestroySurfaceKHR(_instance, _surface, nullptr);
+		}
 
 		vkDestroyDevice(_device, nullptr);
 		vkDestroyInstance(_instance, nullptr);
 
-		SDL_DestroyWindow(_window);
+		if (!_headless) {
+			SDL_DestroyWindow(_window);
+		}
 	}
 }
 
 
 void VulkanEngine::draw()
 {
+	VK_TRACE_ZONE("draw");
 
-	//FPS Count
-	auto finish = std::chrono::high_resolution_clock::now();
-	if (_frameNumber % 20 == 0) {
-		if (!duration_cast<std::chrono::milliseconds>(finish - _previousTime).count() == 0){
-			float fps = 1000 / duration_cast<std::chrono::milliseconds>(finish - _previousTime).count();
-			std::cout << "FPS: " << fps << "\n";
-		}
-		
+	//filled in as the frame goes and added to _frameStats once it was presented
+	FrameTiming timing;
+
+	FrameData& frame = get_current_frame();
+
+	//assets streamed in since the last frame go out now. Their copies run on the transfer queue
+	//while this frame renders, and this frame's submission is already ordered after them
+	submit_uploads();
+
+	//materials whose pipelines finished compiling since last frame start drawing with them
+	resolve_pending_materials();
+
+	//a minimized window has nothing to render to, try again next frame
+	if (_resizeRequested && !recreate_swapchain()) {
+		return;
+	}
+
+	//wait until the GPU has finished rendering the last frame that used this slot. Timeout of 1 second
+	//the other frames in flight keep the GPU busy while we record this one
+	auto waitStart = high_resolution_clock::now();
+	{
+		VK_TRACE_ZONE("wait render fence");
+		VK_CHECK(vkWaitForFences(_device, 1, &frame._renderFence, true, 1000000000));
 	}
-	_previousTime = finish;
 
-	//wait until the GPU has finished rendering the last frame. Timeout of 1 second
-	VK_CHECK(vkWaitForFences(_device, 1, &_renderFence, true, 1000000000));
-	VK_CHECK(vkResetFences(_device, 1, &_renderFence));
+	//the fence above was the one of the frame _framesInFlight back, geometry freed up to then isn't read anymore
+	if (_frameNumber >= (int)_framesInFlight) {
+		_geometryPool.release_freed(_frameNumber - _framesInFlight);
+		_compactGeometryPool.release_freed(_frameNumber - _framesInFlight);
+	}
 
-	//request image from the swapchain, one second timeout
 	uint32_t swapchainImageIndex;
-	VK_CHECK(vkAcquireNextImageKHR(_device, _swapchain, 1000000000, _presentSemaphore, nullptr, &swapchainImageIndex));
+	if (_headless) {
+		//offscreen targets belong to frame slots, the fence wait above covers their last use
+		swapchainImageIndex = _frameNumber % _framesInFlight;
+	}
+	else {
+		//request image from the swapchain, one second timeout
+		VkResult acquireResult;
+		{
+			VK_TRACE_ZONE("acquire image");
+			acquireResult = vkAcquireNextImageKHR(_device, _swapchain, 1000000000, frame._presentSemaphore, nullptr, &swapchainImageIndex);
+		}
+		if (acquireResult == VK_ERROR_OUT_OF_DATE_KHR) {
+			//nothing was submitted for this slot, so its fence stays signalled for the retry
+			_resizeRequested = true;
+			return;
+		}
+		if (acquireResult != VK_SUBOPTIMAL_KHR) {
+			VK_CHECK(acquireResult);
+		}
+	}
+	timing.waitMs = duration<float, std::milli>(high_resolution_clock::now() - waitStart).count();
+
+	//only reset once we know this frame will be submitted
+	VK_CHECK(vkResetFences(_device, 1, &frame._renderFence));
 
 	//now that we are sure that the commands finished executing, we can safely reset the command buffer to begin recording again.
-	VK_CHECK(vkResetCommandBuffer(_mainCommandBuffer, 0));
+	VK_CHECK(vkResetCommandBuffer(frame._mainCommandBuffer, 0));
 
 	//naming it cmd for shorter writing
-	VkCommandBuffer cmd = _mainCommandBuffer;
+	VkCommandBuffer cmd = frame._mainCommandBuffer;
 
 	//begin the command buffer recording. We will use this command buffer exactly once, so we want to let Vulkan know that
 	VkCommandBufferBeginInfo cmdBeginInfo = {};
@@ -494,6 +796,14 @@ void VulkanEngine::draw()
 
 	VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
 
+	//the fence wait above covers the queries this slot wrote last time, reading them back doesn't stall
+	_gpuProfiler.begin_frame(cmd, _frameNumber % _framesInFlight);
+	uint32_t frameScope = _gpuProfiler.begin_scope(cmd, "frame");
+
+	if (_gpuProfilerLogInterval > 0 && _frameNumber % _gpuProfilerLogInterval == 0 && _frameNumber > 0) {
+		std::cout << _gpuProfiler.summary() << "\n";
+	}
+
 
 
 
@@ -518,11 +828,60 @@ void VulkanEngine::draw()
 	rpInfo.pClearValues = &clearValues[0];
 	
 
-	vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
+	update_camera();
+
+	update_scene();
+
+	//covers the render pass only, every path below opens it right before beginning the pass
+	uint32_t passScope = UINT32_MAX;
+
+	if (_renderPath == RenderPath::GPUDriven && _gpuDrivenSupported) {
+		update_gpu_scene();
+
+		//culling writes the draws the render pass consumes, so it goes first
+		uint32_t cullScope = _gpuProfiler.begin_scope(cmd, "culling");
+		record_gpu_culling(frame, cmd);
+		_gpuProfiler.end_scope(cmd, cullScope, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+		passScope = _gpuProfiler.begin_scope(cmd, "render pass");
+		vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+		_drawStats = draw_gpu_driven(frame, cmd);
+	}
+	else if (_parallelRecording) {
+		//only what is in the frustum goes into the draw list
+		cull_scene();
+
+		//sort this frame's objects so recording binds each pipeline and mesh as few times as possible
+		_drawList.build(_renderables.data(), (uint32_t)_renderables.size(), _view, _zNear, _zFar);
+		upload_instances(frame);
 
-	draw_objects(cmd, _renderables.data(), _renderables.size());
+		//the draws live in secondary command buffers, the primary only executes them
+		passScope = _gpuProfiler.begin_scope(cmd, "render pass");
+		vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+		uint32_t secondaryCount = record_secondary_draws(frame, _framebuffers[swapchainImageIndex]);
+		if (secondaryCount > 0) {
+			vkCmdExecuteCommands(cmd, secondaryCount, frame._secondaryCommandBuffers);
+		}
+	}
+	else {
+		cull_scene();
+
+		_drawList.build(_renderables.data(), (uint32_t)_renderables.size(), _view, _zNear, _zFar);
+		upload_instances(frame);
+
+		passScope = _gpuProfiler.begin_scope(cmd, "render pass");
+		vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+		_drawStats = draw_objects(cmd, 0, _drawList.batch_count());
+	}
 	//finalize the render pass
 	vkCmdEndRenderPass(cmd);
+	_gpuProfiler.end_scope(cmd, passScope);
+
+	_gpuProfiler.end_scope(cmd, frameScope);
+
 	//finalize the command buffer (we can no longer add commands, but it can now be executed)
 	VK_CHECK(vkEndCommandBuffer(cmd));
 
@@ -541,48 +900,92 @@ void VulkanEngine::draw()
 
 	submit.pWaitDstStageMask = &waitStage;
 
-	submit.waitSemaphoreCount = 1;
-	submit.pWaitSemaphores = &_presentSemaphore;
+	//headless frames have no image to wait for and nothing to present
+	submit.waitSemaphoreCount = _headless ? 0 : 1;
+	submit.pWaitSemaphores = &frame._presentSemaphore;
 
-	submit.signalSemaphoreCount = 1;
-	submit.pSignalSemaphores = &_renderSemaphore;
+	submit.signalSemaphoreCount = _headless ? 0 : 1;
+	submit.pSignalSemaphores = &frame._renderSemaphore;
 
 	submit.commandBufferCount = 1;
 	submit.pCommandBuffers = &cmd;
 
 	//submit command buffer to the queue and execute it.
 	// _renderFence will now block until the graphic commands finish execution
-	VK_CHECK(vkQueueSubmit(_graphicsQueue, 1, &submit, _renderFence));
+	auto submitStart = high_resolution_clock::now();
+	{
+		VK_TRACE_ZONE("submit");
+		VK_CHECK(vkQueueSubmit(_graphicsQueue, 1, &submit, frame._renderFence));
+	}
 
 
 
 
 
 
-	// this will put the image we just rendered into the visible window.
-// we want to wait on the _renderSemaphore for that,
-// as it's necessary that drawing commands have finished before the image is displayed to the user
-	VkPresentInfoKHR presentInfo = {};
-	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-	presentInfo.pNext = nullptr;
+	if (!_headless) {
+		// this will put the image we just rendered into the visible window.
+		// we want to wait on the _renderSemaphore for that,
+		// as it's necessary that drawing commands have finished before the image is displayed to the user
+		VkPresentInfoKHR presentInfo = {};
+		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+		presentInfo.pNext = nullptr;
 
-	presentInfo.pSwapchains = &_swapchain;
-	presentInfo.swapchainCount = 1;
+		presentInfo.pSwapchains = &_swapchain;
+		presentInfo.swapchainCount = 1;
+
+		presentInfo.pWaitSemaphores = &frame._renderSemaphore;
+		presentInfo.waitSemaphoreCount = 1;
+
+		presentInfo.pImageIndices = &swapchainImageIndex;
+
+		VkResult presentResult;
+		{
+			VK_TRACE_ZONE("present");
+			presentResult = vkQueuePresentKHR(_graphicsQueue, &presentInfo);
+		}
+		if (presentResult == VK_ERROR_OUT_OF_DATE_KHR || presentResult == VK_SUBOPTIMAL_KHR) {
+			_resizeRequested = true;
+		}
+		else {
+			VK_CHECK(presentResult);
+		}
+	}
 
-	presentInfo.pWaitSemaphores = &_renderSemaphore;
-	presentInfo.waitSemaphoreCount = 1;
+	auto frameEnd = high_resolution_clock::now();
+	timing.submitMs = duration<float, std::milli>(frameEnd - submitStart).count();
 
-	presentInfo.pImageIndices = &swapchainImageIndex;
+	//frames that returned early, for a resize, count towards the next one
+	if (_frameNumber > 0) {
+		timing.frameMs = duration<float, std::milli>(frameEnd - _previousTime).count();
+		_frameStats.add_frame(timing);
+	}
+	_previousTime = frameEnd;
 
-	VK_CHECK(vkQueuePresentKHR(_graphicsQueue, &presentInfo));
+	if (_frameStatsLogInterval > 0 && _frameNumber % _frameStatsLogInterval == 0 && _frameNumber > 0) {
+		std::cout << _frameStats.summary_line(_frameStatsLogInterval) << " | draws: " << _drawStats.drawCalls
+			<< ", instanced draws: " << _drawStats.instancedDraws << ", pipeline binds: " << _drawStats.pipelineBinds
+			<< ", vertex buffer binds: " << _drawStats.vertexBufferBinds << "\n";
+	}
 
 	//increase the number of frames drawn
 	_frameNumber++;
 }
 
 
+FrameData& VulkanEngine::get_current_frame()
+{
+	return _frames[_frameNumber % _framesInFlight];
+}
+
+
 void VulkanEngine::run()
 {
+	if (_headless) {
+		run_headless();
+		return;
+	}
+
 	SDL_Event e;
 	bool bQuit = false;
 	SDL_SetRelativeMouseMode(SDL_TRUE);
@@ -620,10 +1023,24 @@ void VulkanEngine::run()
 					glm::vec3 right = -normalize(glm::vec3(inverted[0]));
 					_tgtPos += right * 0.22f;
 					break;
+				case(SDLK_g):
+					//switch between CPU and GPU-driven rendering to compare them
+					_renderPath = _renderPath == RenderPath::CPU ? RenderPath::GPUDriven : RenderPath::CPU;
+					std::cout << "Render path: " << (_renderPath == RenderPath::CPU ? "CPU" : "GPU-driven") << "\n";
+					break;
+				case(SDLK_t):
+					//everything the frame loop measures, on demand rather than logged every few hundred frames
+					write_trace(_traceOutput.empty() ? "trace.json" : _traceOutput.c_str());
+					write_frame_stats(_frameStatsOutput.empty() ? "frame_stats.csv" : _frameStatsOutput.c_str());
+					std::cout << _frameStats.summary_line() << "\n" << _gpuProfiler.summary() << "\n";
+					break;
 				}
 
 
 
+			}
+			else if (e.type == SDL_WINDOWEVENT && e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+				_resizeRequested = true;
 			}
 			else if (e.type == SDL_MOUSEMOTION) {
 				pitch += glm::radians((float)e.motion.yrel) * 5;
@@ -635,57 +1052,315 @@ void VulkanEngine::run()
 		_camPos = 0.025f * _tgtPos + 0.975f * _camPos;
 		draw();
 	}
+
+	if (!_traceOutput.empty()) {
+		write_trace(_traceOutput.c_str());
+	}
+	if (!_frameStatsOutput.empty()) {
+		write_frame_stats(_frameStatsOutput.c_str());
+	}
 }
 
-bool VulkanEngine::load_shader_module(const char* filePath, VkShaderModule* outShaderModule)
+void VulkanEngine::write_frame_stats(const char* path)
 {
-	//open the file. With cursor at the end
-	std::ifstream file(filePath, std::ios::ate | std::ios::binary);
-
-	if (!file.is_open()) {
-		return false;
+	if (_frameStats.write_csv(path)) {
+		std::cout << "Wrote frame timings to " << path << "\n";
 	}
+	else {
+		std::cout << "Failed to write frame timings to " << path << "\n";
+	}
+}
 
-	//find what the size of the file is by looking up the location of the cursor
-//because the cursor is at the end, it gives the size directly in bytes
-	size_t fileSize = (size_t)file.tellg();
+void VulkanEngine::write_trace(const char* path)
+{
+	if (!VK_TRACE_ENABLED) {
+		std::cout << "CPU zones are compiled out, build with VK_TRACE_ENABLED to record them\n";
+	}
+	else if (vktrace::write_chrome_trace(path)) {
+		std::cout << "Wrote CPU trace to " << path << "\n";
+	}
+	else {
+		std::cout << "Failed to write CPU trace to " << path << "\n";
+	}
+}
 
-	//spirv expects the buffer to be on uint32, so make sure to reserve an int vector big enough for the entire file
-	std::vector<uint32_t> buffer(fileSize / sizeof(uint32_t));
+void VulkanEngine::run_headless()
+{
+	//no input, the camera stays where it starts so every run renders the same frames
+	auto start = high_resolution_clock::now();
 
-	//put file cursor at beginning
-	file.seekg(0);
+	for (uint32_t i = 0; i < _headlessFrames; i++) {
+		draw();
+	}
+	VK_CHECK(vkDeviceWaitIdle(_device));
 
-	//load the entire file into the buffer
-	file.read((char*)buffer.data(), fileSize);
+	auto elapsed = duration_cast<microseconds>(high_resolution_clock::now() - start);
+	float milliseconds = elapsed.count() / 1000.f;
+	std::cout << "Headless: " << _headlessFrames << " frames in " << milliseconds << " ms, "
+		<< (milliseconds / std::max(_headlessFrames, 1u)) << " ms per frame" << std::endl;
+	std::cout << _frameStats.summary_line() << std::endl;
 
-	//now that the file is loaded into the buffer, we can close it
-	file.close();
+	if (!_traceOutput.empty()) {
+		write_trace(_traceOutput.c_str());
+	}
+	if (!_frameStatsOutput.empty()) {
+		write_frame_stats(_frameStatsOutput.c_str());
+	}
+}
 
+void VulkanEngine::init_pipeline_cache()
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(_chosenGPU, &properties);
+
+	//the file is only reused if it was written by the same vendor, device and driver build
+	std::vector<char> cacheData;
+	std::ifstream file(_pipelineCachePath, std::ios::ate | std::ios::binary);
+	if (file.is_open()) {
+		cacheData.resize((size_t)file.tellg());
+		file.seekg(0);
+		file.read(cacheData.data(), cacheData.size());
+		file.close();
+
+		if (!is_pipeline_cache_valid(cacheData, properties)) {
+			std::cout << "Pipeline cache " << _pipelineCachePath << " is from another device or driver, rebuilding it" << std::endl;
+			cacheData.clear();
+		}
+	}
 
-	//create a new shader module, using the buffer we loaded
-	VkShaderModuleCreateInfo createInfo = {};
-	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	createInfo.pNext = nullptr;
+	VkPipelineCacheCreateInfo cacheInfo = {};
+	cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheInfo.pNext = nullptr;
+	cacheInfo.initialDataSize = cacheData.size();
+	cacheInfo.pInitialData = cacheData.empty() ? nullptr : cacheData.data();
+
+	//drivers may still reject data that passed the header check, start empty in that case
+	if (vkCreatePipelineCache(_device, &cacheInfo, nullptr, &_pipelineCache) != VK_SUCCESS) {
+		std::cout << "Pipeline cache data was rejected by the driver, rebuilding it" << std::endl;
+		cacheInfo.initialDataSize = 0;
+		cacheInfo.pInitialData = nullptr;
+		cacheData.clear();
+		VK_CHECK(vkCreatePipelineCache(_device, &cacheInfo, nullptr, &_pipelineCache));
+	}
 
-	//codeSize has to be in bytes, so multiply the ints in the buffer by size of int to know the real size of the buffer
-	createInfo.codeSize = buffer.size() * sizeof(uint32_t);
-	createInfo.pCode = buffer.data();
+	_pipelineCacheWarm = !cacheData.empty();
 
-	//check that the creation goes well.
-	VkShaderModule shaderModule;
-	if (vkCreateShaderModule(_device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
-		return false;
-	}
-	*outShaderModule = shaderModule;
-	return true;
+	//saved on cleanup, after every pipeline that could add to it has been created
+	_mainDeletionQueue.push_function([=]() {
+		save_pipeline_cache();
+		vkDestroyPipelineCache(_device, _pipelineCache, nullptr);
+		});
 
-}
+	//background compiles go through the same cache
+	_pipelineCompiler.init(_device, _pipelineCache, &_jobSystem);
+	_pipelineStates.init(&_pipelineCompiler);
 
+	_mainDeletionQueue.push_function([=]() {
+		_pipelineCompiler.destroy();
 
-void VulkanEngine::init_pipelines() {
+		for (auto& shaderModule : _shaderModules) {
+			vkDestroyShaderModule(_device, shaderModule.second, nullptr);
+		}
+		_shaderModules.clear();
+		});
+}
 
-	
+bool VulkanEngine::is_pipeline_cache_valid(const std::vector<char>& data, const VkPhysicalDeviceProperties& properties)
+{
+	//VkPipelineCacheHeaderVersionOne: header size, header version, vendor id, device id, cache UUID
+	const size_t headerSize = 16 + VK_UUID_SIZE;
+	if (data.size() < headerSize) {
+		return false;
+	}
+
+	uint32_t header[4];
+	memcpy(header, data.data(), sizeof(header));
+
+	if (header[0] < headerSize || header[0] > data.size()) {
+		return false;
+	}
+	if (header[1] != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) {
+		return false;
+	}
+	if (header[2] != properties.vendorID || header[3] != properties.deviceID) {
+		return false;
+	}
+	return memcmp(data.data() + 16, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void VulkanEngine::save_pipeline_cache()
+{
+	size_t dataSize = 0;
+	if (vkGetPipelineCacheData(_device, _pipelineCache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0) {
+		return;
+	}
+
+	std::vector<char> data(dataSize);
+	if (vkGetPipelineCacheData(_device, _pipelineCache, &dataSize, data.data()) != VK_SUCCESS) {
+		return;
+	}
+
+	//write to a temporary file first, so a crash halfway through never leaves a truncated cache behind
+	std::string tempPath = _pipelineCachePath + ".tmp";
+	std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		std::cout << "Could not write pipeline cache to " << tempPath << std::endl;
+		return;
+	}
+	file.write(data.data(), dataSize);
+	file.close();
+
+	std::remove(_pipelineCachePath.c_str());
+	std::rename(tempPath.c_str(), _pipelineCachePath.c_str());
+}
+
+bool VulkanEngine::load_shader_module(const char* filePath, VkShaderModule* outShaderModule)
+{
+	//open the file. With cursor at the end
+	std::ifstream file(filePath, std::ios::ate | std::ios::binary);
+
+	if (!file.is_open()) {
+		return false;
+	}
+
+	//find what the size of the file is by looking up the location of the cursor
+//because the cursor is at the end, it gives the size directly in bytes
+	size_t fileSize = (size_t)file.tellg();
+
+	//spirv expects the buffer to be on uint32, so make sure to reserve an int vector big enough for the entire file
+	std::vector<uint32_t> buffer(fileSize / sizeof(uint32_t));
+
+	//put file cursor at beginning
+	file.seekg(0);
+
+	//load the entire file into the buffer
+	file.read((char*)buffer.data(), fileSize);
+
+	//now that the file is loaded into the buffer, we can close it
+	file.close();
+
+
+	//create a new shader module, using the buffer we loaded
+	VkShaderModuleCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	createInfo.pNext = nullptr;
+
+	//codeSize has to be in bytes, so multiply the ints in the buffer by size of int to know the real size of the buffer
+	createInfo.codeSize = buffer.size() * sizeof(uint32_t);
+	createInfo.pCode = buffer.data();
+
+	//check that the creation goes well.
+	VkShaderModule shaderModule;
+	if (vkCreateShaderModule(_device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
+		return false;
+	}
+	*outShaderModule = shaderModule;
+	return true;
+
+}
+
+
+void VulkanEngine::init_descriptors()
+{
+	//one set per frame in flight for the GPU-driven path, 4 storage buffers each
+	VkDescriptorPoolSize sizes[] = {
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4 * MAX_FRAMES_IN_FLIGHT }
+	};
+
+	VkDescriptorPoolCreateInfo pool_info = {};
+	pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	pool_info.flags = 0;
+	pool_info.maxSets = MAX_FRAMES_IN_FLIGHT;
+	pool_info.poolSizeCount = (uint32_t)(sizeof(sizes) / sizeof(sizes[0]));
+	pool_info.pPoolSizes = sizes;
+
+	VK_CHECK(vkCreateDescriptorPool(_device, &pool_info, nullptr, &_descriptorPool));
+
+	//the vertex shader only reads the objects, everything else is culling input/output
+	VkDescriptorSetLayoutBinding bindings[] = {
+		vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT, 0),
+		vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1),
+		vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 2),
+		vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 3),
+	};
+
+	VkDescriptorSetLayoutCreateInfo setinfo = {};
+	setinfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	setinfo.pNext = nullptr;
+	setinfo.flags = 0;
+	setinfo.bindingCount = (uint32_t)(sizeof(bindings) / sizeof(bindings[0]));
+	setinfo.pBindings = bindings;
+
+	VK_CHECK(vkCreateDescriptorSetLayout(_device, &setinfo, nullptr, &_gpuDrivenSetLayout));
+
+	for (uint32_t i = 0; i < _framesInFlight; i++) {
+		VkDescriptorSetAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.pNext = nullptr;
+		allocInfo.descriptorPool = _descriptorPool;
+		allocInfo.descriptorSetCount = 1;
+		allocInfo.pSetLayouts = &_gpuDrivenSetLayout;
+
+		//the buffers are written in once the GPU scene is first built
+		VK_CHECK(vkAllocateDescriptorSets(_device, &allocInfo, &_frames[i]._gpuDrivenDescriptor));
+	}
+
+	//indirect draws: the object set, plus the camera in the same push constants as the other mesh pipelines
+	VkPushConstantRange meshConstants;
+	meshConstants.offset = 0;
+	meshConstants.size = sizeof(MeshPushConstants);
+	meshConstants.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+	VkPipelineLayoutCreateInfo indirect_layout_info = vkinit::pipeline_layout_create_info();
+	indirect_layout_info.setLayoutCount = 1;
+	indirect_layout_info.pSetLayouts = &_gpuDrivenSetLayout;
+	indirect_layout_info.pushConstantRangeCount = 1;
+	indirect_layout_info.pPushConstantRanges = &meshConstants;
+
+	VK_CHECK(vkCreatePipelineLayout(_device, &indirect_layout_info, nullptr, &_indirectPipelineLayout));
+
+	//culling: the same set, plus frustum and object count
+	VkPushConstantRange cullConstants;
+	cullConstants.offset = 0;
+	cullConstants.size = sizeof(GPUCullConstants);
+	cullConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkPipelineLayoutCreateInfo cull_layout_info = vkinit::pipeline_layout_create_info();
+	cull_layout_info.setLayoutCount = 1;
+	cull_layout_info.pSetLayouts = &_gpuDrivenSetLayout;
+	cull_layout_info.pushConstantRangeCount = 1;
+	cull_layout_info.pPushConstantRanges = &cullConstants;
+
+	VK_CHECK(vkCreatePipelineLayout(_device, &cull_layout_info, nullptr, &_cullPipelineLayout));
+
+	_mainDeletionQueue.push_function([=]() {
+		vkDestroyPipelineLayout(_device, _cullPipelineLayout, nullptr);
+		vkDestroyPipelineLayout(_device, _indirectPipelineLayout, nullptr);
+		vkDestroyDescriptorSetLayout(_device, _gpuDrivenSetLayout, nullptr);
+		vkDestroyDescriptorPool(_device, _descriptorPool, nullptr);
+		});
+
+	//the GPU scene buffers are created on first use and replaced when the scene outgrows them
+	_mainDeletionQueue.push_function([=]() {
+		if (_gpuObjectCapacity > 0) {
+			vmaDestroyBuffer(_allocator, _gpuObjectBuffer._buffer, _gpuObjectBuffer._allocation);
+			for (uint32_t i = 0; i < _framesInFlight; i++) {
+				vmaDestroyBuffer(_allocator, _frames[i]._indirectBuffer._buffer, _frames[i]._indirectBuffer._allocation);
+			}
+		}
+		if (_gpuBatchCapacity > 0) {
+			vmaDestroyBuffer(_allocator, _gpuBatchBuffer._buffer, _gpuBatchBuffer._allocation);
+			for (uint32_t i = 0; i < _framesInFlight; i++) {
+				vmaDestroyBuffer(_allocator, _frames[i]._drawCountBuffer._buffer, _frames[i]._drawCountBuffer._allocation);
+			}
+		}
+		});
+}
+
+
+void VulkanEngine::init_pipelines() {
+
+	
 
 
 	//build the pipeline layout that controls the inputs/outputs of the shader
@@ -705,17 +1380,6 @@ void VulkanEngine::init_pipelines() {
 	//we are just going to draw triangle list
 	pipelineBuilder._inputAssembly = vkinit::input_assembly_create_info(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
 
-	//build viewport and scissor from the swapchain extents
-	pipelineBuilder._viewport.x = 0.0f;
-	pipelineBuilder._viewport.y = 0.0f;
-	pipelineBuilder._viewport.width = (float)_windowExtent.width;
-	pipelineBuilder._viewport.height = (float)_windowExtent.height;
-	pipelineBuilder._viewport.minDepth = 0.0f;
-	pipelineBuilder._viewport.maxDepth = 1.0f;
-
-	pipelineBuilder._scissor.offset = { 0, 0 };
-	pipelineBuilder._scissor.extent = _windowExtent;
-
 	//configure the rasterizer to draw filled triangles
 	pipelineBuilder._rasterizer = vkinit::rasterization_state_create_info(VK_POLYGON_MODE_FILL);
 
@@ -736,41 +1400,26 @@ void VulkanEngine::init_pipelines() {
 
 		//build the mesh pipeline
 
-	VertexInputDescription vertexDescription = Vertex::get_vertex_description();
-
-	//connect the pipeline builder vertex input info to the one we get from Vertex
-	pipelineBuilder._vertexInputInfo.pVertexAttributeDescriptions = vertexDescription.attributes.data();
-	pipelineBuilder._vertexInputInfo.vertexAttributeDescriptionCount = vertexDescription.attributes.size();
-
-	pipelineBuilder._vertexInputInfo.pVertexBindingDescriptions = vertexDescription.bindings.data();
-	pipelineBuilder._vertexInputInfo.vertexBindingDescriptionCount = vertexDescription.bindings.size();
+	pipelineBuilder.set_vertex_description(Vertex::get_vertex_description());
 
 	//clear the shader stages for the builder
 	pipelineBuilder._shaderStages.clear();
 
-	//compile mesh vertex shader
-
-
-	VkShaderModule meshVertShader;
-	if (!load_shader_module("../../../../shaders/tri_mesh.vert.spv", &meshVertShader))
-	{
-		std::cout << "Error when building the triangle mesh vertex shader module" << std::endl;
-	}
-	else {
-		std::cout << "Triangle mesh vertex shader successfully loaded" << std::endl;
-	}
-
-
-	VkShaderModule triangleFragShader;
-	if (!load_shader_module("../../../../shaders/coloured_triangle.frag.spv", &triangleFragShader))
-	{
-		std::cout << "Error when building the triangle mesh vertex shader module" << std::endl;
-	}
-	else {
-		std::cout << "Triangle mesh vertex shader successfully loaded" << std::endl;
+	//shader modules are cached for the whole run, pipelines compiled in the background still need them
+	VkShaderModule meshVertShader = get_shader_module("../../../../shaders/tri_mesh.vert.spv");
+	VkShaderModule triangleFragShader = get_shader_module("../../../../shaders/coloured_triangle.frag.spv");
+	VkShaderModule instancedVertShader = get_shader_module("../../../../shaders/tri_mesh_instanced.vert.spv");
+	VkShaderModule indirectVertShader = get_shader_module("../../../../shaders/tri_mesh_indirect.vert.spv");
+	VkShaderModule cullCompShader = get_shader_module("../../../../shaders/cull.comp.spv");
+
+	//a missing or stale .spv would otherwise only show up as a crash inside the driver
+	for (VkShaderModule module : { meshVertShader, triangleFragShader, instancedVertShader, indirectVertShader, cullCompShader }) {
+		if (module == VK_NULL_HANDLE) {
+			std::cout << "Required shader modules failed to load, build the Shaders target to compile them" << std::endl;
+			abort();
+		}
 	}
 
-
 	//add the other shaders
 	pipelineBuilder._shaderStages.push_back(
 		vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT, meshVertShader));
@@ -807,27 +1456,61 @@ void VulkanEngine::init_pipelines() {
 
 	pipelineBuilder._pipelineLayout = _meshPipelineLayout;
 
-	_meshPipeline = pipelineBuilder.build_pipeline(_device, _renderPass);
+	//the default material is built right away, it is the fallback everything else draws with while compiling
+	_meshPipeline = _pipelineStates.get_pipeline(pipelineBuilder, _renderPass);
+
 
+	//instanced variant: same layout and state, but transforms come from a per-instance vertex stream
+	PipelineBuilder instancedBuilder = pipelineBuilder;
+	instancedBuilder.set_vertex_description(Vertex::get_instanced_vertex_description());
+	instancedBuilder._shaderStages[0] = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT,
+		instancedVertShader);
 
-	create_material(_meshPipeline, _meshPipelineLayout, "defaultmesh");
+	_meshInstancedPipeline = _pipelineStates.get_pipeline(instancedBuilder, _renderPass);
 
 
+	//GPU-driven variant: regular vertex layout, transforms from the object storage buffer
+	PipelineBuilder indirectBuilder = pipelineBuilder;
+	indirectBuilder._shaderStages[0] = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT,
+		indirectVertShader);
+	indirectBuilder._pipelineLayout = _indirectPipelineLayout;
 
+	_meshIndirectPipeline = _pipelineStates.get_pipeline(indirectBuilder, _renderPass);
 
 
+	//hits the three pipelines built above
+	create_material(pipelineBuilder, "defaultmesh", &instancedBuilder, &indirectBuilder);
 
-	//destroy all shader modules, outside of the queue
-	vkDestroyShaderModule(_device, meshVertShader, nullptr);
 
-	vkDestroyShaderModule(_device, triangleFragShader, nullptr);
+	//compact vertex variants: the same three shaders with COMPACT_VERTICES specialized to true.
+	//They compile on the job system while the first frames render
+	pipelineBuilder.set_vertex_description(CompactVertex::get_vertex_description());
+	pipelineBuilder.set_specialization_constant(0, VK_TRUE);
+
+	instancedBuilder.set_vertex_description(CompactVertex::get_instanced_vertex_description());
+	instancedBuilder.set_specialization_constant(0, VK_TRUE);
+
+	indirectBuilder.set_vertex_description(CompactVertex::get_vertex_description());
+	indirectBuilder.set_specialization_constant(0, VK_TRUE);
+
+	//a compact mesh can't be drawn with a regular vertex layout, so there is no fallback and its objects are skipped until ready
+	create_material_async("defaultmesh_compact", _meshPipelineLayout, pipelineBuilder, &instancedBuilder, &indirectBuilder, nullptr);
+
+
+	//culling compute pipeline
+	VkComputePipelineCreateInfo computePipelineInfo = {};
+	computePipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	computePipelineInfo.pNext = nullptr;
+	computePipelineInfo.stage = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT,
+		cullCompShader);
+	computePipelineInfo.layout = _cullPipelineLayout;
+
+	VK_CHECK(vkCreateComputePipelines(_device, _pipelineCache, 1, &computePipelineInfo, nullptr, &_cullPipeline));
 
 
 	_mainDeletionQueue.push_function([=]() {
-		//destroy the 2 pipelines we have created
-		
-		
-		vkDestroyPipeline(_device, _meshPipeline, nullptr);
+		//graphics pipelines come from the pipeline state cache and are destroyed by the compiler
+		vkDestroyPipeline(_device, _cullPipeline, nullptr);
 
 		//destroy the pipeline layout that they use
 		
@@ -839,68 +1522,31 @@ void VulkanEngine::init_pipelines() {
 }
 
 
-VkPipeline PipelineBuilder::build_pipeline(VkDevice device, VkRenderPass pass) {
-	//make viewport state from our stored viewport and scissor.
-	//at the moment we won't support multiple viewports or scissors
-	VkPipelineViewportStateCreateInfo viewportState = {};
-	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-	viewportState.pNext = nullptr;
-
-	viewportState.viewportCount = 1;
-	viewportState.pViewports = &_viewport;
-	viewportState.scissorCount = 1;
-	viewportState.pScissors = &_scissor;
-
-	//setup dummy color blending. We aren't using transparent objects yet
-	//the blending is just "no blend", but we do write to the color attachment
-	VkPipelineColorBlendStateCreateInfo colorBlending = {};
-	colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-	colorBlending.pNext = nullptr;
-
-	colorBlending.logicOpEnable = VK_FALSE;
-	colorBlending.logicOp = VK_LOGIC_OP_COPY;
-	colorBlending.attachmentCount = 1;
-	colorBlending.pAttachments = &_colorBlendAttachment;
-
-	VkGraphicsPipelineCreateInfo pipelineInfo = {};
-
-	//build the actual pipeline
-	//we now use all of the info structs we have been writing into into this one to create the pipeline
-	//VkGraphicsPipelineCreateInfo pipelineInfo = {};
-	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	pipelineInfo.pNext = nullptr;
-
-	pipelineInfo.stageCount = _shaderStages.size();
-	pipelineInfo.pStages = _shaderStages.data();
-	pipelineInfo.pVertexInputState = &_vertexInputInfo;
-	pipelineInfo.pInputAssemblyState = &_inputAssembly;
-	pipelineInfo.pViewportState = &viewportState;
-	pipelineInfo.pRasterizationState = &_rasterizer;
-	pipelineInfo.pMultisampleState = &_multisampling;
-	pipelineInfo.pColorBlendState = &colorBlending;
-	pipelineInfo.layout = _pipelineLayout;
-	pipelineInfo.renderPass = pass;
-	pipelineInfo.subpass = 0;
-	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
-	pipelineInfo.pDepthStencilState = &_depthStencil;
-
-	//it's easy to error out on create graphics pipeline, so we handle it a bit better than the common VK_CHECK case
-	VkPipeline newPipeline;
-	if (vkCreateGraphicsPipelines(
-		device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &newPipeline) != VK_SUCCESS) {
-		std::cout << "failed to create pipeline\n";
-		return VK_NULL_HANDLE; // failed to create graphics pipeline
-	}
-	else
+VkShaderModule VulkanEngine::get_shader_module(const std::string& path)
+{
+	auto it = _shaderModules.find(path);
+	if (it != _shaderModules.end()) {
+		return it->second;
+	}
+
+	VkShaderModule module = VK_NULL_HANDLE;
+	if (!load_shader_module(path.c_str(), &module))
 	{
-		return newPipeline;
+		std::cout << "Error when building the shader module " << path << std::endl;
+	}
+	else {
+		std::cout << "Shader module " << path << " successfully loaded" << std::endl;
 	}
 
+	_shaderModules[path] = module;
+	return module;
 }
 
 
 void VulkanEngine::load_meshes()
 {
+	VK_TRACE_ZONE("load_meshes");
+
 	_triangleMesh._vertices.resize(3);
 
 	_triangleMesh._vertices[0].position = { 1.f,1.f, 0.5f };
@@ -911,13 +1557,37 @@ void VulkanEngine::load_meshes()
 	_triangleMesh._vertices[1].color = { 1.f,0.f, 0.0f }; //pure green
 	_triangleMesh._vertices[2].color = { 0.f,0.f, 1.0f }; //pure green
 
-	//load the monkey
-	_monkeyMesh.load_from_obj("../../../../assets/monkey.obj");
-	//_monkeyMesh.load_from_obj("../../../../assets/uploads_files.obj");
+	_triangleMesh._indices = { 0, 1, 2 };
 
-	//make sure both meshes are sent to the GPU
+	_triangleMesh.compute_bounds();
+
+	//parse the OBJ files in parallel, uploading them still happens on this thread
+	struct MeshFile {
+		Mesh* mesh;
+		const char* path;
+		VertexFormat format;
+	};
+	MeshFile meshFiles[] = {
+		{ &_monkeyMesh, "../../../../assets/monkey.obj", VertexFormat::Compact },
+		//{ &_monkeyMesh, "../../../../assets/uploads_files.obj", VertexFormat::Compact },
+	};
+
+	JobCounter loadCounter;
+	bool optimize = _optimizeMeshes;
+	for (MeshFile& file : meshFiles) {
+		file.mesh->_vertexFormat = file.format;
+		_jobSystem.run([file, optimize]() {
+			if (file.mesh->load_from_obj(file.path) && optimize) {
+				meshopt::optimize_mesh(*file.mesh, file.path);
+			}
+			}, &loadCounter);
+	}
+	_jobSystem.wait(&loadCounter);
+
+	//make sure both meshes are sent to the GPU, in a single submission
 	upload_mesh(_triangleMesh);
 	upload_mesh(_monkeyMesh);
+	flush_uploads();
 
 	//note that we are copying them. Eventually we will delete the hardcoded _monkey and _triangle meshes, so it's no problem now.
 	_meshes["monkey"] = _monkeyMesh;
@@ -925,54 +1595,157 @@ void VulkanEngine::load_meshes()
 
 }
 
-void VulkanEngine::upload_mesh(Mesh& mesh)
+Mesh* VulkanEngine::add_mesh(const std::string& name, const Mesh& mesh)
 {
-	//allocate vertex buffer
-	VkBufferCreateInfo bufferInfo = {};
-	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	//this is the total size, in bytes, of the buffer we are allocating
-	bufferInfo.size = mesh._vertices.size() * sizeof(Vertex);
-	//this buffer is going to be used as a Vertex Buffer
-	bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	//replacing a mesh would leak its pool allocation and change the data under every renderable pointing at it
+	auto existing = _meshes.find(name);
+	if (existing != _meshes.end()) {
+		std::cout << "Mesh " << name << " already exists, keeping the existing one" << std::endl;
+		assert(!"add_mesh called with a name that is already taken");
+		return &existing->second;
+	}
 
+	//map nodes don't move, so the geometry allocation can be recorded in place
+	Mesh& stored = _meshes[name];
+	stored = mesh;
+	upload_mesh(stored);
+	return &stored;
+}
 
-	//let the VMA library know that this data should be writeable by CPU, but also readable by GPU
-	VmaAllocationCreateInfo vmaallocInfo = {};
-	vmaallocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+void VulkanEngine::upload_mesh(Mesh& mesh)
+{
+	mesh._meshId = _meshCount++;
 
-	//allocate the buffer
-	VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaallocInfo,
-		&mesh._vertexBuffer._buffer,
-		&mesh._vertexBuffer._allocation,
-		nullptr));
+	//a zero sized allocation or copy isn't valid Vulkan. The mesh keeps no geometry block, and draw lists skip it
+	if (mesh._vertices.empty() || mesh._indices.empty()) {
+		mesh._geometry = GeometryAllocation{};
+		return;
+	}
 
-	//add the destruction of triangle mesh buffer to the deletion queue
-	_mainDeletionQueue.push_function([=]() {
+	//compact meshes are encoded here, the full precision vertices stay on the CPU
+	std::vector<CompactVertex> compactVertices;
+	const void* vertexData = mesh._vertices.data();
+	size_t vertexDataSize = mesh._vertices.size() * sizeof(Vertex);
+	if (mesh._vertexFormat == VertexFormat::Compact) {
+		compactVertices = mesh.quantize();
+		vertexData = compactVertices.data();
+		vertexDataSize = compactVertices.size() * sizeof(CompactVertex);
+	}
 
-		vmaDestroyBuffer(_allocator, mesh._vertexBuffer._buffer, mesh._vertexBuffer._allocation);
-		});
+	//meshes are sub-allocated from the pool of their vertex format instead of getting buffers of their own
+	GeometryPool& pool = mesh._vertexFormat == VertexFormat::Compact ? _compactGeometryPool : _geometryPool;
+	mesh._geometry = pool.allocate((uint32_t)mesh._vertices.size(), (uint32_t)mesh._indices.size());
 
+	//the pool lives in device-local memory, the data goes through the staging ring.
+	//The copies are only submitted on the next flush_uploads() or when the ring needs the space
+	const GeometryAllocation& geometry = mesh._geometry;
+	upload_to_buffer(geometry.block->_vertexBuffer._buffer, (size_t)geometry.firstVertex * pool.vertex_stride(), vertexData, vertexDataSize);
+	upload_to_buffer(geometry.block->_indexBuffer._buffer, (size_t)geometry.firstIndex * sizeof(uint32_t), mesh._indices.data(), mesh._indices.size() * sizeof(uint32_t));
 
+}
 
-	void* data;
-	vmaMapMemory(_allocator, mesh._vertexBuffer._allocation, &data);
 
-	memcpy(data, mesh._vertices.data(), mesh._vertices.size() * sizeof(Vertex));
 
-	vmaUnmapMemory(_allocator, mesh._vertexBuffer._allocation);
 
-}
+Material* VulkanEngine::create_material(VkPipeline pipeline, VkPipelineLayout layout, const std::string& name, VkPipeline instancedPipeline)
+{
+	//materials that share a pipeline share its id, so they sort next to each other.
+	//The id is the one of the pipeline that will actually be bound
+	VkPipeline boundPipeline = instancedPipeline != VK_NULL_HANDLE ? instancedPipeline : pipeline;
 
+	Material mat;
+	mat.pipeline = pipeline;
+	mat.pipelineLayout = layout;
+	mat.instancedPipeline = instancedPipeline;
+	mat.indirectPipeline = VK_NULL_HANDLE;
+	mat.pipelineId = get_pipeline_id(boundPipeline);
+	mat.materialId = _materialCount++;
+	_materials[name] = mat;
+	return &_materials[name];
+}
 
+Material* VulkanEngine::create_material(const PipelineBuilder& builder, const std::string& name,
+	const PipelineBuilder* instancedBuilder, const PipelineBuilder* indirectBuilder)
+{
+	VkPipeline pipeline = _pipelineStates.get_pipeline(builder, _renderPass);
+	VkPipeline instancedPipeline = instancedBuilder ? _pipelineStates.get_pipeline(*instancedBuilder, _renderPass) : VK_NULL_HANDLE;
 
+	Material* material = create_material(pipeline, builder._pipelineLayout, name, instancedPipeline);
+	material->indirectPipeline = indirectBuilder ? _pipelineStates.get_pipeline(*indirectBuilder, _renderPass) : VK_NULL_HANDLE;
+	return material;
+}
 
-Material* VulkanEngine::create_material(VkPipeline pipeline, VkPipelineLayout layout, const std::string& name)
+Material* VulkanEngine::create_material_async(const std::string& name, VkPipelineLayout layout, const PipelineBuilder& builder,
+	const PipelineBuilder* instancedBuilder, const PipelineBuilder* indirectBuilder, Material* fallback)
 {
 	Material mat;
-	mat.pipeline = pipeline;
+	mat.pipeline = VK_NULL_HANDLE;
 	mat.pipelineLayout = layout;
+	mat.instancedPipeline = VK_NULL_HANDLE;
+	mat.indirectPipeline = VK_NULL_HANDLE;
+	//sorts with whatever it is drawn with until its own pipelines are in
+	mat.pipelineId = fallback ? fallback->pipelineId : 0;
+	mat.materialId = _materialCount++;
+	mat.fallback = fallback;
+	mat.ready = false;
 	_materials[name] = mat;
-	return &_materials[name];
+
+	PendingMaterial pending;
+	pending.material = &_materials[name];
+	pending.pipeline = _pipelineStates.get_pipeline_async(builder, _renderPass);
+	pending.instancedPipeline = instancedBuilder ? _pipelineStates.get_pipeline_async(*instancedBuilder, _renderPass) : nullptr;
+	pending.indirectPipeline = indirectBuilder ? _pipelineStates.get_pipeline_async(*indirectBuilder, _renderPass) : nullptr;
+	_pendingMaterials.push_back(pending);
+
+	return pending.material;
+}
+
+void VulkanEngine::resolve_pending_materials()
+{
+	auto is_done = [](const AsyncPipeline* pipeline) {
+		return pipeline == nullptr || pipeline->is_ready();
+	};
+	auto get_pipeline = [](const AsyncPipeline* pipeline) {
+		return pipeline ? pipeline->pipeline.load(std::memory_order_relaxed) : VK_NULL_HANDLE;
+	};
+
+	for (size_t i = 0; i < _pendingMaterials.size();) {
+		PendingMaterial& pending = _pendingMaterials[i];
+		if (!is_done(pending.pipeline) || !is_done(pending.instancedPipeline) || !is_done(pending.indirectPipeline)) {
+			i++;
+			continue;
+		}
+
+		Material* material = pending.material;
+		material->pipeline = get_pipeline(pending.pipeline);
+		material->instancedPipeline = get_pipeline(pending.instancedPipeline);
+		material->indirectPipeline = get_pipeline(pending.indirectPipeline);
+
+		//a material whose main pipeline failed keeps drawing with its fallback
+		if (material->pipeline != VK_NULL_HANDLE) {
+			VkPipeline boundPipeline = material->instancedPipeline != VK_NULL_HANDLE ? material->instancedPipeline : material->pipeline;
+			material->pipelineId = get_pipeline_id(boundPipeline);
+			material->ready = true;
+
+			//its objects change batches
+			_gpuSceneDirty = true;
+		}
+		else {
+			std::cout << "Background pipeline compilation failed for material " << material->materialId << std::endl;
+		}
+
+		_pendingMaterials[i] = _pendingMaterials.back();
+		_pendingMaterials.pop_back();
+	}
+}
+
+uint16_t VulkanEngine::get_pipeline_id(VkPipeline pipeline)
+{
+	auto pipelineId = _pipelineIds.find(pipeline);
+	if (pipelineId == _pipelineIds.end()) {
+		pipelineId = _pipelineIds.emplace(pipeline, (uint16_t)_pipelineIds.size()).first;
+	}
+	return pipelineId->second;
 }
 
 Material* VulkanEngine::get_material(const std::string& name)
@@ -1000,7 +1773,47 @@ Mesh* VulkanEngine::get_mesh(const std::string& name)
 }
 
 
-void VulkanEngine::draw_objects(VkCommandBuffer cmd, RenderObject* first, int count)
+void VulkanEngine::update_scene()
+{
+	//objects under a destroyed one have dead transforms now. The update below compacts those away and
+	//reuses their ids, so the objects have to go first
+	if (_gameObjectsDestroyed) {
+		for (uint32_t i = 0; i < _gameObjects.size();) {
+			if (_transforms.is_alive(_gameObjects.at(i).transform)) {
+				i++;
+			}
+			else {
+				//the last object moves into slot i, so i is checked again
+				_scene.destroy(_gameObjects.at(i).entity);
+				_gameObjects.destroy(_gameObjects.handle_at(i));
+			}
+		}
+		_gameObjectsDestroyed = false;
+	}
+
+	_transforms.update_parallel(_jobSystem);
+
+	rendersys::sync_transforms(_scene, _transforms, _jobSystem);
+}
+
+void VulkanEngine::cull_scene()
+{
+	VK_TRACE_ZONE("cull_scene");
+
+	//only entities with bounds are culled and drawn, so the ones created without get them here
+	if (_scene.structure_version() != _boundsCheckedVersion) {
+		rendersys::add_missing_bounds(_scene);
+		_boundsCheckedVersion = _scene.structure_version();
+	}
+
+	rendersys::update_bounds(_scene, _jobSystem);
+	rendersys::cull(_scene, make_frustum(_projection * _view), _jobSystem, _visibleBounds);
+
+	_renderables.clear();
+	rendersys::collect_visible(_scene, _visibleBounds, _renderables);
+}
+
+void VulkanEngine::update_camera()
 {
 	glm::vec3 camAxis = { 1,0,0 };
 
@@ -1011,59 +1824,584 @@ void VulkanEngine::draw_objects(VkCommandBuffer cmd, RenderObject* first, int co
 	cameraRotationTransform = view;
 
 	//camera projection
-	glm::mat4 projection = glm::perspective(glm::radians(70.f), 1700.f / 900.f, 0.1f, 200.0f);
+	glm::mat4 projection = glm::perspective(glm::radians(70.f), (float)_windowExtent.width / (float)_windowExtent.height, _zNear, _zFar);
 	projection[1][1] *= -1;
 
+	_view = view;
+	_projection = projection;
+}
 
 
+uint32_t VulkanEngine::record_secondary_draws(FrameData& frame, VkFramebuffer framebuffer)
+{
+	_drawStats = {};
 
-	/*
-	Mesh* lastMesh = nullptr;
-	Material* lastMaterial = nullptr;
-	for (int i = 0; i < count; i++)
-	{
-		RenderObject& object = first[i];
+	//chunks are contiguous ranges of whole batches, so each one still only binds on state changes
+	std::vector<uint32_t>& boundaries = _chunkBoundaries;
+	_drawList.split_batches(_recordingThreads, _minDrawsPerChunk, boundaries);
+
+	uint32_t chunkCount = (uint32_t)boundaries.size() - 1;
+	if (chunkCount == 0) {
+		return 0;
+	}
+
+	VkCommandBufferInheritanceInfo inheritanceInfo = vkinit::command_buffer_inheritance_info(_renderPass, 0, framebuffer);
+
+	DrawStats chunkStats[MAX_RECORDING_THREADS];
+
+	//each chunk owns its pool and buffer, so it doesn't matter which thread picks it up
+	JobCounter recordCounter;
+	_jobSystem.parallel_for(chunkCount, 1, [&](uint32_t chunk, uint32_t) {
+
+		VkCommandBuffer secondary = frame._secondaryCommandBuffers[chunk];
+
+		//the fence of this frame was waited on, so nothing in the pool is in use anymore
+		VK_CHECK(vkResetCommandPool(_device, frame._recordPools[chunk], 0));
+
+		VkCommandBufferBeginInfo beginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT);
+		beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+		VK_CHECK(vkBeginCommandBuffer(secondary, &beginInfo));
+
+		chunkStats[chunk] = draw_objects(secondary, boundaries[chunk], boundaries[chunk + 1]);
+
+		VK_CHECK(vkEndCommandBuffer(secondary));
+		}, &recordCounter);
+
+	//the main thread records chunks too while it waits
+	_jobSystem.wait(&recordCounter);
+
+	for (uint32_t chunk = 0; chunk < chunkCount; chunk++) {
+		_drawStats += chunkStats[chunk];
+	}
+
+	return chunkCount;
+}
+
+
+void VulkanEngine::upload_instances(FrameData& frame)
+{
+	uint32_t instanceCount = _drawList.size();
+
+	if (instanceCount > frame._instanceCapacity) {
+		//this frame's fence was waited on, so the GPU is done with the old buffer
+		if (frame._instanceCapacity > 0) {
+			vmaDestroyBuffer(_allocator, frame._instanceBuffer._buffer, frame._instanceBuffer._allocation);
+		}
+
+		//grow geometrically so a slowly growing scene doesn't reallocate every frame
+		frame._instanceCapacity = glm::max(instanceCount, frame._instanceCapacity * 2);
+		frame._instanceBuffer = create_buffer(frame._instanceCapacity * sizeof(InstanceData), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, VMA_ALLOCATION_CREATE_MAPPED_BIT);
+
+		VmaAllocationInfo allocationInfo;
+		vmaGetAllocationInfo(_allocator, frame._instanceBuffer._allocation, &allocationInfo);
+		frame._instanceData = (InstanceData*)allocationInfo.pMappedData;
+	}
+
+	if (instanceCount > 0) {
+		_drawList.write_instances(frame._instanceData);
+
+		//CPU_TO_GPU memory isn't always HOST_COHERENT, so the writes are flushed to be visible to the GPU.
+		//VMA skips the flush on coherent memory
+		vmaFlushAllocation(_allocator, frame._instanceBuffer._allocation, 0, (VkDeviceSize)instanceCount * sizeof(InstanceData));
+	}
+}
+
+
+DrawStats VulkanEngine::draw_objects(VkCommandBuffer cmd, uint32_t begin, uint32_t end)
+{
+	VK_TRACE_ZONE("draw_objects");
+
+	//secondary command buffers don't inherit dynamic state, so every chunk sets it
+	set_viewport(cmd);
+
+	return _drawList.record(cmd, begin, end, _projection * _view, get_current_frame()._instanceBuffer._buffer);
+}
+
+
+void VulkanEngine::update_gpu_scene()
+{
+	//entities or components were added or removed
+	if (_scene.structure_version() != _gpuSceneVersion) {
+		_gpuSceneDirty = true;
+	}
+	if (!_gpuSceneDirty) {
+		return;
+	}
+
+	//scene changes are rare, and the other frames in flight still read the buffers we are about to replace
+	VK_CHECK(vkDeviceWaitIdle(_device));
+
+	_gpuSceneDirty = false;
+	_gpuSceneVersion = _scene.structure_version();
+
+	//every renderable that isn't hidden, the GPU culls them itself
+	_gpuSceneObjects.clear();
+	rendersys::collect_renderables(_scene, true, _gpuSceneObjects);
+
+	//sorted once into (material, mesh) batches. Depth order doesn't matter here, the GPU culls every frame
+	_gpuSceneList.build(_gpuSceneObjects.data(), (uint32_t)_gpuSceneObjects.size(), glm::mat4{ 1.0f }, _zNear, _zFar);
+
+	uint32_t objectCount = _gpuSceneList.size();
+	uint32_t batchCount = _gpuSceneList.batch_count();
+	bool reallocated = false;
+
+	if (objectCount > _gpuObjectCapacity || _gpuObjectCapacity == 0) {
+		if (_gpuObjectCapacity > 0) {
+			vmaDestroyBuffer(_allocator, _gpuObjectBuffer._buffer, _gpuObjectBuffer._allocation);
+			for (uint32_t i = 0; i < _framesInFlight; i++) {
+				vmaDestroyBuffer(_allocator, _frames[i]._indirectBuffer._buffer, _frames[i]._indirectBuffer._allocation);
+			}
+		}
 
-		//only bind the pipeline if it doesn't match with the already bound one
-		if (object.material != lastMaterial) {
+		_gpuObjectCapacity = glm::max(glm::max(objectCount, _gpuObjectCapacity * 2), 1u);
 
-			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipeline);
-			lastMaterial = object.material;
+		_gpuObjectBuffer = create_buffer(_gpuObjectCapacity * sizeof(GPUObjectData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+		for (uint32_t i = 0; i < _framesInFlight; i++) {
+			//one command slot per object, only ever touched by the GPU
+			_frames[i]._indirectBuffer = create_buffer(_gpuObjectCapacity * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
 		}
+		reallocated = true;
+	}
+
+	if (batchCount > _gpuBatchCapacity || _gpuBatchCapacity == 0) {
+		if (_gpuBatchCapacity > 0) {
+			vmaDestroyBuffer(_allocator, _gpuBatchBuffer._buffer, _gpuBatchBuffer._allocation);
+			for (uint32_t i = 0; i < _framesInFlight; i++) {
+				vmaDestroyBuffer(_allocator, _frames[i]._drawCountBuffer._buffer, _frames[i]._drawCountBuffer._allocation);
+			}
+		}
+
+		_gpuBatchCapacity = glm::max(glm::max(batchCount, _gpuBatchCapacity * 2), 1u);
+
+		_gpuBatchBuffer = create_buffer(_gpuBatchCapacity * sizeof(GPUBatchData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+		for (uint32_t i = 0; i < _framesInFlight; i++) {
+			//cleared with vkCmdFillBuffer every frame before culling
+			_frames[i]._drawCountBuffer = create_buffer(_gpuBatchCapacity * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+		}
+		reallocated = true;
+	}
+
+	if (reallocated) {
+		for (uint32_t i = 0; i < _framesInFlight; i++) {
+			VkDescriptorBufferInfo objectInfo = { _gpuObjectBuffer._buffer, 0, VK_WHOLE_SIZE };
+			VkDescriptorBufferInfo batchInfo = { _gpuBatchBuffer._buffer, 0, VK_WHOLE_SIZE };
+			VkDescriptorBufferInfo commandInfo = { _frames[i]._indirectBuffer._buffer, 0, VK_WHOLE_SIZE };
+			VkDescriptorBufferInfo countInfo = { _frames[i]._drawCountBuffer._buffer, 0, VK_WHOLE_SIZE };
+
+			VkWriteDescriptorSet writes[] = {
+				vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _frames[i]._gpuDrivenDescriptor, &objectInfo, 0),
+				vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _frames[i]._gpuDrivenDescriptor, &batchInfo, 1),
+				vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _frames[i]._gpuDrivenDescriptor, &commandInfo, 2),
+				vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _frames[i]._gpuDrivenDescriptor, &countInfo, 3),
+			};
+
+			vkUpdateDescriptorSets(_device, 4, writes, 0, nullptr);
+		}
+	}
+
+	GPUObjectData* objects;
+	GPUBatchData* batches;
+	vmaMapMemory(_allocator, _gpuObjectBuffer._allocation, (void**)&objects);
+	vmaMapMemory(_allocator, _gpuBatchBuffer._allocation, (void**)&batches);
+
+	for (uint32_t b = 0; b < batchCount; b++) {
+		const DrawBatch& batch = _gpuSceneList.batch(b);
+		const Mesh* mesh = _gpuSceneList.get(batch.first).mesh;
+
+		//batch regions in the indirect buffer line up with the objects, so the uncompacted path can write command i for object i
+		batches[b].indexCount = mesh->_geometry.indexCount;
+		batches[b].firstIndex = mesh->_geometry.firstIndex;
+		batches[b].vertexOffset = (int32_t)mesh->_geometry.firstVertex;
+		batches[b].commandOffset = batch.first;
+
+		for (uint32_t i = batch.first; i < batch.first + batch.count; i++) {
+			objects[i].model = _gpuSceneList.get(i).transformMatrix;
+			objects[i].sphereBounds = glm::vec4(mesh->_bounds.origin, mesh->_bounds.radius);
+			objects[i].batchIndex = b;
+		}
+	}
+
+	vmaUnmapMemory(_allocator, _gpuObjectBuffer._allocation);
+	vmaUnmapMemory(_allocator, _gpuBatchBuffer._allocation);
+}
+
+
+void VulkanEngine::record_gpu_culling(FrameData& frame, VkCommandBuffer cmd)
+{
+	uint32_t objectCount = _gpuSceneList.size();
+	if (objectCount == 0) {
+		return;
+	}
+
+	//the compacting path counts visible draws per batch with atomics, starting from 0
+	vkCmdFillBuffer(cmd, frame._drawCountBuffer._buffer, 0, VK_WHOLE_SIZE, 0);
+
+	VkBufferMemoryBarrier clearBarrier = vkinit::buffer_barrier(frame._drawCountBuffer._buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &clearBarrier, 0, nullptr);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _cullPipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _cullPipelineLayout, 0, 1, &frame._gpuDrivenDescriptor, 0, nullptr);
+
+	Frustum frustum = make_frustum(_projection * _view);
 
+	GPUCullConstants constants;
+	for (int i = 0; i < 6; i++) {
+		constants.frustumPlanes[i] = frustum.planes[i];
+	}
+	constants.objectCount = objectCount;
+	constants.compact = _vkCmdDrawIndexedIndirectCount != nullptr ? 1 : 0;
+
+	vkCmdPushConstants(cmd, _cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GPUCullConstants), &constants);
+
+	//matches local_size_x in cull.comp
+	vkCmdDispatch(cmd, (objectCount + 255) / 256, 1, 1);
+
+	//the draws read what culling wrote
+	VkBufferMemoryBarrier cullBarriers[] = {
+		vkinit::buffer_barrier(frame._indirectBuffer._buffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT),
+		vkinit::buffer_barrier(frame._drawCountBuffer._buffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT),
+	};
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 0, nullptr, 2, cullBarriers, 0, nullptr);
+}
+
+
+DrawStats VulkanEngine::draw_gpu_driven(FrameData& frame, VkCommandBuffer cmd)
+{
+	DrawStats stats;
+
+	if (_gpuSceneList.size() == 0) {
+		return stats;
+	}
+
+	set_viewport(cmd);
+
+	//all indirect pipelines share one layout, so the set is bound once for the whole pass
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _indirectPipelineLayout, 0, 1, &frame._gpuDrivenDescriptor, 0, nullptr);
 
-		glm::mat4 model = object.transformMatrix;
-		//final render matrix, that we are calculating on the cpu
-		glm::mat4 mesh_matrix = projection * view * model;
+	MeshPushConstants constants;
+	constants.render_matrix = _projection * _view;
 
-		MeshPushConstants constants;
-		constants.render_matrix = mesh_matrix;
+	VkPipeline lastPipeline = VK_NULL_HANDLE;
+	const Mesh* lastMesh = nullptr;
+	const GeometryBlock* lastBlock = nullptr;
+	const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
 
-		//upload the mesh to the GPU via push constants
-		vkCmdPushConstants(cmd, object.material->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+	for (uint32_t b = 0; b < _gpuSceneList.batch_count(); b++) {
+		const DrawBatch& batch = _gpuSceneList.batch(b);
+		const RenderObject& first = _gpuSceneList.get(batch.first);
 
-		//only bind the mesh if it's a different one from last bind
-		if (object.mesh != lastMesh) {
-			//bind the mesh vertex buffer with offset 0
+		VkPipeline pipeline = drawable_material(first.material)->indirectPipeline;
+		if (pipeline == VK_NULL_HANDLE) {
+			continue;
+		}
+
+		if (pipeline != lastPipeline) {
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+			lastPipeline = pipeline;
+			stats.pipelineBinds++;
+		}
+
+		if (first.mesh->_geometry.block != lastBlock) {
 			VkDeviceSize offset = 0;
-			vkCmdBindVertexBuffers(cmd, 0, 1, &object.mesh->_vertexBuffer._buffer, &offset);
-			lastMesh = object.mesh;
+			vkCmdBindVertexBuffers(cmd, 0, 1, &first.mesh->_geometry.block->_vertexBuffer._buffer, &offset);
+			vkCmdBindIndexBuffer(cmd, first.mesh->_geometry.block->_indexBuffer._buffer, 0, VK_INDEX_TYPE_UINT32);
+			lastBlock = first.mesh->_geometry.block;
+			stats.vertexBufferBinds++;
+		}
+
+		if (first.mesh != lastMesh) {
+			lastMesh = first.mesh;
+
+			//the camera plus this mesh's dequantization
+			constants.data = first.mesh->_dequantization;
+			vkCmdPushConstants(cmd, _indirectPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+		}
+
+		VkDeviceSize commandOffset = (VkDeviceSize)batch.first * stride;
+
+		if (_vkCmdDrawIndexedIndirectCount) {
+			//only the visible draws culling packed at the start of the batch region
+			_vkCmdDrawIndexedIndirectCount(cmd, frame._indirectBuffer._buffer, commandOffset, frame._drawCountBuffer._buffer, b * sizeof(uint32_t), batch.count, stride);
+			stats.drawCalls++;
+		}
+		else if (_multiDrawIndirectSupported) {
+			//every object of the batch, culled ones have an instance count of 0
+			vkCmdDrawIndexedIndirect(cmd, frame._indirectBuffer._buffer, commandOffset, batch.count, stride);
+			stats.drawCalls++;
 		}
-		//we can now draw
-		vkCmdDraw(cmd, object.mesh->_vertices.size(), 1, 0, 0);
+		else {
+			for (uint32_t i = 0; i < batch.count; i++) {
+				vkCmdDrawIndexedIndirect(cmd, frame._indirectBuffer._buffer, commandOffset + i * stride, 1, stride);
+			}
+			stats.drawCalls += batch.count;
+		}
+
+		stats.objects += batch.count;
 	}
-	*/
-	
+
+	return stats;
+}
+
+
+AllocatedBuffer VulkanEngine::create_buffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, VmaAllocationCreateFlags flags)
+{
+	//allocate vertex buffer
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.pNext = nullptr;
+
+	bufferInfo.size = allocSize;
+	bufferInfo.usage = usage;
+
+	VmaAllocationCreateInfo vmaallocInfo = {};
+	vmaallocInfo.usage = memoryUsage;
+	vmaallocInfo.flags = flags;
+
+	AllocatedBuffer newBuffer;
+
+	//allocate the buffer
+	VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaallocInfo,
+		&newBuffer._buffer,
+		&newBuffer._allocation,
+		nullptr));
+
+	return newBuffer;
+}
+
+AllocatedBuffer VulkanEngine::upload_buffer(const void* data, size_t size, VkBufferUsageFlags usage, uint64_t* ticket)
+{
+	AllocatedBuffer buffer = create_buffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+
+	uint64_t uploadTicket = upload_to_buffer(buffer._buffer, 0, data, size);
+	if (ticket) {
+		*ticket = uploadTicket;
+	}
+
+	return buffer;
 }
 
-void VulkanEngine::add_to_root(GameObject go)
+uint64_t VulkanEngine::upload_to_buffer(VkBuffer buffer, size_t offset, const void* data, size_t size)
 {
+	uint64_t ticket = 0;
+	const size_t segmentSize = STAGING_BUFFER_SIZE / UPLOAD_BATCHES;
+	const uint8_t* bytes = (const uint8_t*)data;
+
+	while (size > 0) {
+		UploadBatch& batch = get_upload_batch();
+
+		size_t segmentEnd = (_uploadContext._currentBatch + 1) * segmentSize;
+		size_t space = segmentEnd - _uploadContext._stagingHead;
+		if (space == 0) {
+			submit_upload_batch();
+			continue;
+		}
 
-	gameObjects[gameObjectsIndex] = go;
-	gameObjects[gameObjectsIndex].parent = nullptr;
-	root[rootGameObjectsIndex] = &gameObjects[gameObjectsIndex];
+		size_t chunk = glm::min(space, size);
+		memcpy(_uploadContext._stagingData + _uploadContext._stagingHead, bytes, chunk);
+
+		VkBufferCopy copy = {};
+		copy.srcOffset = _uploadContext._stagingHead;
+		copy.dstOffset = offset;
+		copy.size = chunk;
+		vkCmdCopyBuffer(batch._commandBuffer, _uploadContext._stagingBuffer._buffer, buffer, 1, &copy);
+
+		//the range is released by the transfer family and acquired by the graphics family once the batch is submitted
+		if (_transferQueueFamily != _graphicsQueueFamily) {
+			VkBufferMemoryBarrier ownership = vkinit::buffer_barrier(buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+			ownership.srcQueueFamilyIndex = _transferQueueFamily;
+			ownership.dstQueueFamilyIndex = _graphicsQueueFamily;
+			ownership.offset = offset;
+			ownership.size = chunk;
+			batch._ownershipBarriers.push_back(ownership);
+		}
+
+		ticket = batch._serial;
+
+		_uploadContext._stagingHead += chunk;
+		bytes += chunk;
+		offset += chunk;
+		size -= chunk;
+	}
 
-	gameObjectsIndex++;
-	rootGameObjectsIndex++;
+	return ticket;
+}
+
+UploadBatch& VulkanEngine::get_upload_batch()
+{
+	UploadBatch& batch = _uploadContext._batches[_uploadContext._currentBatch];
+	if (batch._recording) {
+		return batch;
+	}
+
+	//the last submission from this segment has to finish before its staging memory is overwritten
+	{
+		VK_TRACE_ZONE("wait upload fence");
+		VK_CHECK(vkWaitForFences(_device, 1, &batch._uploadFence, true, UINT64_MAX));
+	}
+	VK_CHECK(vkResetFences(_device, 1, &batch._uploadFence));
+	VK_CHECK(vkResetCommandPool(_device, batch._commandPool, 0));
+
+	VkCommandBufferBeginInfo beginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	VK_CHECK(vkBeginCommandBuffer(batch._commandBuffer, &beginInfo));
+
+	batch._recording = true;
+	batch._serial = ++_uploadContext._batchSerial;
+	batch._ownershipBarriers.clear();
+	_uploadContext._stagingHead = _uploadContext._currentBatch * (STAGING_BUFFER_SIZE / UPLOAD_BATCHES);
+	return batch;
+}
+
+void VulkanEngine::submit_upload_batch()
+{
+	UploadBatch& batch = _uploadContext._batches[_uploadContext._currentBatch];
+	if (!batch._recording) {
+		return;
+	}
+
+	if (batch._ownershipBarriers.empty()) {
+		//same queue family, a plain barrier makes the copies visible to everything submitted afterwards
+		VkMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+		vkCmdPipelineBarrier(batch._commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+		VK_CHECK(vkEndCommandBuffer(batch._commandBuffer));
+
+		VkSubmitInfo submit = vkinit::submit_info(&batch._commandBuffer);
+		VK_CHECK(vkQueueSubmit(_transferQueue, 1, &submit, batch._uploadFence));
+	}
+	else {
+		//release on the transfer queue. The destination access masks only matter on the acquire side
+		std::vector<VkBufferMemoryBarrier> release = batch._ownershipBarriers;
+		for (VkBufferMemoryBarrier& barrier : release) {
+			barrier.dstAccessMask = 0;
+		}
+		vkCmdPipelineBarrier(batch._commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, (uint32_t)release.size(), release.data(), 0, nullptr);
+
+		VK_CHECK(vkEndCommandBuffer(batch._commandBuffer));
+
+		VkSubmitInfo submit = vkinit::submit_info(&batch._commandBuffer);
+		submit.signalSemaphoreCount = 1;
+		submit.pSignalSemaphores = &batch._transferSemaphore;
+		VK_CHECK(vkQueueSubmit(_transferQueue, 1, &submit, VK_NULL_HANDLE));
+
+		//acquire on the graphics queue. Everything submitted there later is ordered after this barrier,
+		//so frames can use the buffers without the CPU waiting for the copies
+		VK_CHECK(vkResetCommandPool(_device, batch._acquirePool, 0));
+
+		VkCommandBufferBeginInfo beginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+		VK_CHECK(vkBeginCommandBuffer(batch._acquireCommandBuffer, &beginInfo));
+
+		std::vector<VkBufferMemoryBarrier> acquire = batch._ownershipBarriers;
+		for (VkBufferMemoryBarrier& barrier : acquire) {
+			barrier.srcAccessMask = 0;
+		}
+		vkCmdPipelineBarrier(batch._acquireCommandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, (uint32_t)acquire.size(), acquire.data(), 0, nullptr);
+
+		VK_CHECK(vkEndCommandBuffer(batch._acquireCommandBuffer));
+
+		VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+		VkSubmitInfo acquireSubmit = vkinit::submit_info(&batch._acquireCommandBuffer);
+		acquireSubmit.waitSemaphoreCount = 1;
+		acquireSubmit.pWaitSemaphores = &batch._transferSemaphore;
+		acquireSubmit.pWaitDstStageMask = &waitStage;
+
+		//the fence covers both halves, so the semaphore has been waited on before the batch is reused
+		VK_CHECK(vkQueueSubmit(_graphicsQueue, 1, &acquireSubmit, batch._uploadFence));
+	}
+
+	batch._recording = false;
+	_uploadContext._currentBatch = (_uploadContext._currentBatch + 1) % UPLOAD_BATCHES;
+}
+
+void VulkanEngine::submit_uploads()
+{
+	submit_upload_batch();
+}
+
+bool VulkanEngine::is_upload_complete(uint64_t ticket)
+{
+	//slots are only reused after their fence signalled, so older batches that are gone are done
+	for (uint32_t i = 0; i < UPLOAD_BATCHES; i++) {
+		const UploadBatch& batch = _uploadContext._batches[i];
+		if (batch._serial == 0 || batch._serial > ticket) {
+			continue;
+		}
+		if (batch._recording || vkGetFenceStatus(_device, batch._uploadFence) != VK_SUCCESS) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void VulkanEngine::flush_uploads()
+{
+	submit_upload_batch();
+
+	VK_TRACE_ZONE("wait upload fence");
+	for (uint32_t i = 0; i < UPLOAD_BATCHES; i++) {
+		VK_CHECK(vkWaitForFences(_device, 1, &_uploadContext._batches[i]._uploadFence, true, UINT64_MAX));
+	}
+}
+
+Entity VulkanEngine::create_renderable(Mesh* mesh, Material* material, const glm::mat4& transform)
+{
+	Entity entity = _scene.create();
+	_scene.add<TransformComponent>(entity, { transform, INVALID_TRANSFORM });
+	_scene.add<MeshComponent>(entity, { mesh });
+	_scene.add<MaterialComponent>(entity, { material });
+	_scene.add<BoundsComponent>(entity);
+	_scene.add<VisibilityComponent>(entity);
+	return entity;
+}
+
+Handle<GameObject> VulkanEngine::create_game_object(Mesh* mesh, Material* material, Handle<GameObject> parent)
+{
+	//roots are the objects whose transform has no parent
+	GameObject* parentObject = _gameObjects.get(parent);
+
+	GameObject go;
+	go.transform = _transforms.create(parentObject ? parentObject->transform : INVALID_TRANSFORM);
+	go.entity = create_renderable(mesh, material, glm::mat4{ 1.f });
+
+	//the world matrix follows the hierarchy node from now on
+	_scene.get<TransformComponent>(go.entity)->node = go.transform;
+	return _gameObjects.create(go);
+}
+
+void VulkanEngine::clear_scene()
+{
+	for (uint32_t i = 0; i < _gameObjects.size(); i++) {
+		_transforms.destroy(_gameObjects.at(i).transform);
+	}
+	_gameObjects.clear();
+	_scene.clear();
+}
+
+void VulkanEngine::set_visible(Entity entity, bool visible)
+{
+	VisibilityComponent* visibility = _scene.get<VisibilityComponent>(entity);
+	if (!visibility || visibility->visible == visible) {
+		return;
+	}
+
+	visibility->visible = visible;
+	mark_gpu_scene_dirty();
+}
+
+void VulkanEngine::destroy_game_object(Handle<GameObject> handle)
+{
+	GameObject* go = _gameObjects.get(handle);
+	if (!go) {
+		return;
+	}
 
+	//takes the transforms of the whole subtree with it, the objects attached to them follow in update_scene()
+	_transforms.destroy(go->transform);
+	_scene.destroy(go->entity);
+	_gameObjects.destroy(handle);
+	_gameObjectsDestroyed = true;
 }
@@ -2,6 +2,7 @@
 
 #include <vk_types.h>
 #include <vector>
+#include <string>
 #include <fstream>
 #include <functional>
 #include <deque>
@@ -13,6 +14,14 @@
 #include <unordered_map>
 #include <map>
 #include "vk_gameobject.h"
+#include "vk_jobs.h"
+#include "vk_drawlist.h"
+#include "vk_geometry_pool.h"
+#include "vk_pipelines.h"
+#include "vk_profiler.h"
+#include "vk_trace.h"
+#include "vk_frame_stats.h"
+#include "vk_object_pool.h"
 
 using namespace std::chrono;
 
@@ -38,6 +47,94 @@ struct DeletionQueue
 	}
 };
 
+//upper bound on how many frames the CPU may record ahead of the GPU
+constexpr unsigned int MAX_FRAMES_IN_FLIGHT = 3;
+
+//upper bound on how many secondary command buffers a frame can be recorded into in parallel
+constexpr unsigned int MAX_RECORDING_THREADS = 16;
+
+//everything a single frame needs to be recorded and submitted independently of the others
+struct FrameData {
+	VkSemaphore _presentSemaphore, _renderSemaphore;
+	VkFence _renderFence;
+
+	VkCommandPool _commandPool; //the command pool for this frame's commands
+	VkCommandBuffer _mainCommandBuffer; //the buffer we will record into
+
+	//command pools can't be used from two threads at once, so each recording chunk gets its own pool
+	VkCommandPool _recordPools[MAX_RECORDING_THREADS];
+	VkCommandBuffer _secondaryCommandBuffers[MAX_RECORDING_THREADS];
+
+	//per-instance transforms of this frame's draw list, persistently mapped. Grows when the scene does
+	AllocatedBuffer _instanceBuffer;
+	InstanceData* _instanceData{ nullptr };
+	uint32_t _instanceCapacity{ 0 };
+
+	//GPU-driven path: culling output of this frame, sized with the GPU scene
+	AllocatedBuffer _indirectBuffer;
+	AllocatedBuffer _drawCountBuffer;
+	VkDescriptorSet _gpuDrivenDescriptor;
+};
+
+//staging memory for copies into GPU_ONLY buffers, split into one segment per upload batch
+constexpr size_t STAGING_BUFFER_SIZE = 64 * 1024 * 1024;
+constexpr unsigned int UPLOAD_BATCHES = 4;
+
+//one submission worth of uploads. Its staging segment can be written again once the fence has signalled
+struct UploadBatch {
+	//copies, recorded for the transfer queue
+	VkCommandPool _commandPool;
+	VkCommandBuffer _commandBuffer;
+
+	//queue family ownership acquires, recorded for the graphics queue. Only used when the two families differ
+	VkCommandPool _acquirePool;
+	VkCommandBuffer _acquireCommandBuffer;
+	std::vector<VkBufferMemoryBarrier> _ownershipBarriers;
+
+	//signalled by the transfer submission and waited on by the acquire submission
+	VkSemaphore _transferSemaphore;
+	//signalled once the whole batch has finished, acquire included
+	VkFence _uploadFence;
+
+	//increases with every batch that is started, used as the upload ticket. 0 for never used slots
+	uint64_t _serial{ 0 };
+	bool _recording{ false };
+};
+
+//uploads are written into a persistently mapped staging ring and copied with vkCmdCopyBuffer on the transfer queue.
+//Many uploads share a batch, so they go out in one submission. Only used from the main thread
+struct UploadContext {
+	UploadBatch _batches[UPLOAD_BATCHES];
+	uint32_t _currentBatch{ 0 };
+
+	AllocatedBuffer _stagingBuffer;
+	uint8_t* _stagingData{ nullptr };
+	//next free byte in the current batch's segment
+	size_t _stagingHead{ 0 };
+
+	uint64_t _batchSerial{ 0 };
+};
+
+//default size of a geometry pool block. Meshes that don't fit get a block of their own size
+constexpr uint32_t GEOMETRY_BLOCK_VERTICES = 1024 * 1024;
+constexpr uint32_t GEOMETRY_BLOCK_INDICES = 3 * 1024 * 1024;
+
+//a material whose pipelines are still being compiled. It draws with its fallback until all of them are done
+struct PendingMaterial {
+	Material* material;
+	AsyncPipeline* pipeline;
+	AsyncPipeline* instancedPipeline;
+	AsyncPipeline* indirectPipeline;
+};
+
+//how the scene is turned into draw calls
+enum class RenderPath {
+	//sorted and recorded on the CPU every frame, with instancing
+	CPU,
+	//culled by a compute shader that writes indirect draws, no per-object CPU work per frame
+	GPUDriven
+};
+
 class VulkanEngine {
 public:
 	glm::mat4 cameraRotationTransform{ 0 };
@@ -58,6 +155,9 @@ public:
 
 	DeletionQueue _mainDeletionQueue;
 
+	//everything that depends on the window size: swapchain, depth image and framebuffers. Flushed on every resize
+	DeletionQueue _swapchainDeletionQueue;
+
 	bool _isInitialized{ false };
 	int _frameNumber{ 0 };
 	int _selectedShader{ 0 };
@@ -77,7 +177,10 @@ public:
 
 
 
-	VkSwapchainKHR _swapchain; // from other articles
+	VkSwapchainKHR _swapchain{ VK_NULL_HANDLE }; // from other articles
+
+	//set when the window changed size or the swapchain stopped matching the surface. The next frame rebuilds it
+	bool _resizeRequested{ false };
 
 // image format expected by the windowing system
 	VkFormat _swapchainImageFormat;
@@ -92,8 +195,39 @@ public:
 	VkQueue _graphicsQueue; //queue we will submit to
 	uint32_t _graphicsQueueFamily; //family of that queue
 
-	VkCommandPool _commandPool; //the command pool for our commands
-	VkCommandBuffer _mainCommandBuffer; //the buffer we will record into
+	//queue uploads are copied on. A dedicated transfer queue if the GPU has one, the graphics queue otherwise
+	VkQueue _transferQueue;
+	uint32_t _transferQueueFamily;
+
+	UploadContext _uploadContext;
+
+	//vertex and index data of every mesh, one pool per vertex format
+	GeometryPool _geometryPool;
+	GeometryPool _compactGeometryPool;
+
+	//per-frame command buffers and sync objects, indexed by _frameNumber % _framesInFlight
+	FrameData _frames[MAX_FRAMES_IN_FLIGHT];
+
+	//how many frames may be in flight at once (1 to MAX_FRAMES_IN_FLIGHT). Must be set before init()
+	uint32_t _framesInFlight{ 2 };
+
+	//returns the frame slot that is being recorded this frame
+	FrameData& get_current_frame();
+
+	//threads the job system runs on, including the main thread. 0 picks the hardware concurrency. Must be set before init()
+	uint32_t _jobThreads{ 0 };
+
+	JobSystem _jobSystem;
+
+	//record the scene into secondary command buffers on the job system instead of inline
+	bool _parallelRecording{ true };
+	//most secondary buffers a frame is split into. 0 uses one per job thread. Must be set before init()
+	uint32_t _recordingThreads{ 0 };
+	//below this many draw calls per chunk the fan-out costs more than it saves, so fewer chunks are used
+	uint32_t _minDrawsPerChunk{ 256 };
+
+	//reorder loaded meshes for vertex cache, overdraw and vertex fetch. Must be set before init()
+	bool _optimizeMeshes{ true };
 
 
 	VkRenderPass _renderPass;
@@ -101,22 +235,56 @@ public:
 	std::vector<VkFramebuffer> _framebuffers;
 
 
-	//Semaphore and Fence
-	VkSemaphore _presentSemaphore, _renderSemaphore;
-	VkFence _renderFence;
-
 
+	//shared by every pipeline creation, loaded from and saved to _pipelineCachePath
+	VkPipelineCache _pipelineCache{ VK_NULL_HANDLE };
+	std::string _pipelineCachePath{ "pipeline_cache.bin" };
 
 	VkPipelineLayout _meshPipelineLayout;
 	VkPipeline _meshPipeline;
+	VkPipeline _meshInstancedPipeline;
+	VkPipeline _meshIndirectPipeline;
+
+	VkDescriptorPool _descriptorPool;
+
+	//GPU-driven path: object, batch, indirect command and draw count storage buffers
+	VkDescriptorSetLayout _gpuDrivenSetLayout;
+	VkPipelineLayout _indirectPipelineLayout;
+	VkPipelineLayout _cullPipelineLayout;
+	VkPipeline _cullPipeline;
 	Mesh _triangleMesh;
 
 	VkExtent2D _windowExtent{ 1700 , 900 };
 
 	struct SDL_Window* _window{ nullptr };
 
+	//render into offscreen images instead of a window, without SDL or a surface. Works on software ICDs
+	//like lavapipe or SwiftShader. Set before init()
+	bool _headless{ false };
+
+	//how many frames run() renders before returning when headless
+	uint32_t _headlessFrames{ 1000 };
+
+	//headless color targets, one per frame in flight. Their views are in _swapchainImageViews
+	std::vector<AllocatedImage> _offscreenImages;
+
+	//where the CPU zones are written when run() returns or T is pressed. Empty only dumps on T, to trace.json.
+	//Zones are only recorded in builds with VK_TRACE_ENABLED
+	std::string _traceOutput;
+
+	//end of the last frame's draw()
 	std::chrono::high_resolution_clock::time_point _previousTime;
 
+	//CPU frame, wait and submit timings of the last frames
+	FrameStats _frameStats;
+
+	//every how many frames the frame time distribution is logged. 0, the default, never logs it,
+	//the T key dumps it on demand instead
+	uint32_t _frameStatsLogInterval{ 0 };
+
+	//where the frame timings are written as CSV when run() returns. Empty writes nothing
+	std::string _frameStatsOutput;
+
 	//initializes everything in the engine
 	void init();
 
@@ -129,18 +297,45 @@ public:
 	//run main loop
 	void run();
 
+	//renders _headlessFrames frames with no window or input, then prints the average frame time
+	void run_headless();
+
+	//dumps the recorded CPU zones as a Chrome trace
+	void write_trace(const char* path);
+
+	void write_frame_stats(const char* path);
 
 
 
-	//default array of renderable objects
+
+	//renderable entities, with transform, mesh, material, bounds and visibility components
+	Registry _scene;
+
+	//this frame's visible renderables, collected from _scene by cull_scene()
 	std::vector<RenderObject> _renderables;
+	//bounds pool positions of the entities that passed this frame's frustum culling
+	std::vector<uint32_t> _visibleBounds;
+	//structure version of _scene when cull_scene() last gave every mesh entity bounds
+	uint64_t _boundsCheckedVersion{ UINT64_MAX };
+
+	//local and world transforms of every GameObject, parents before children
+	TransformHierarchy _transforms;
 
 	std::unordered_map<std::string, Material> _materials;
 	std::unordered_map<std::string, Mesh> _meshes;
 	//functions
 
-	//create material and add it to the map
-	Material* create_material(VkPipeline pipeline, VkPipelineLayout layout, const std::string& name);
+	//create material and add it to the map. Objects of materials with an instanced pipeline get batched into instanced draws
+	Material* create_material(VkPipeline pipeline, VkPipelineLayout layout, const std::string& name, VkPipeline instancedPipeline = VK_NULL_HANDLE);
+
+	//same, with the pipelines taken from the pipeline state cache. Builders equal to ones seen before reuse their pipelines
+	Material* create_material(const PipelineBuilder& builder, const std::string& name,
+		const PipelineBuilder* instancedBuilder = nullptr, const PipelineBuilder* indirectBuilder = nullptr);
+
+	//same, but the pipelines are compiled on the job system. Until they are all done the material draws as fallback,
+	//or its objects are skipped if there is none. The builders are copied, the optional ones may be nullptr
+	Material* create_material_async(const std::string& name, VkPipelineLayout layout, const PipelineBuilder& builder,
+		const PipelineBuilder* instancedBuilder, const PipelineBuilder* indirectBuilder, Material* fallback);
 
 	//returns nullptr if it can't be found
 	Material* get_material(const std::string& name);
@@ -148,8 +343,92 @@ public:
 	//returns nullptr if it can't be found
 	Mesh* get_mesh(const std::string& name);
 
-	//our draw function
-	void draw_objects(VkCommandBuffer cmd, RenderObject* first, int count);
+	//camera matrices for the frame being recorded, computed once by update_camera()
+	glm::mat4 _view;
+	glm::mat4 _projection;
+	float _zNear{ 0.1f };
+	float _zFar{ 200.0f };
+
+	//this frame's renderables sorted by pipeline, material, mesh and depth
+	DrawList _drawList;
+	//batch ranges recorded by each secondary command buffer, kept to avoid reallocating every frame
+	std::vector<uint32_t> _chunkBoundaries;
+
+	//draw calls and state changes of the last recorded frame
+	DrawStats _drawStats;
+
+	//GPU timings of the frame, the culling dispatch and the render pass, read back _framesInFlight frames late
+	GpuProfiler _gpuProfiler;
+
+	//every how many frames the GPU profiler's rolling averages are logged. 0, the default, never logs them
+	uint32_t _gpuProfilerLogInterval{ 0 };
+
+	//GPU time of the most recent frame that was read back, in ms. -1 when the graphics queue has no timestamps
+	//or nothing was read yet
+	float gpu_frame_time() const
+	{
+		const GpuScopeStats* frame = _gpuProfiler.find_scope("frame");
+		return frame ? frame->lastMs : -1.f;
+	}
+
+	//blocks until every background pipeline compilation has finished. Pending materials switch over on the next frame
+	void wait_for_pipelines() { _pipelineCompiler.wait_all(); }
+
+	//whether RenderPath::GPUDriven can be used on this device. Otherwise draw() stays on the CPU path
+	bool gpu_driven_supported() const { return _gpuDrivenSupported; }
+
+	//uploads the mesh and adds it to _meshes. The copies go out with the next frame or flush_uploads().
+	//Names can't be reused, a taken one asserts and returns the mesh already stored under it
+	Mesh* add_mesh(const std::string& name, const Mesh& mesh);
+
+	//can be switched at any time, falls back to CPU if the device can't do the GPU-driven path
+	RenderPath _renderPath{ RenderPath::CPU };
+
+	//the GPU scene is rebuilt automatically when entities or components are added to or removed from _scene.
+	//Call this after changing components in place, moving objects included, so the GPU copy picks it up
+	void mark_gpu_scene_dirty() { _gpuSceneDirty = true; }
+
+	//records the batches [begin, end) of this frame's draw list
+	DrawStats draw_objects(VkCommandBuffer cmd, uint32_t begin, uint32_t end);
+
+	AllocatedBuffer create_buffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, VmaAllocationCreateFlags flags = 0);
+
+	//creates a GPU_ONLY buffer and queues a copy of data into it through the staging ring.
+	//ticket, if set, receives the value to pass to is_upload_complete()
+	AllocatedBuffer upload_buffer(const void* data, size_t size, VkBufferUsageFlags usage, uint64_t* ticket = nullptr);
+
+	//queues a copy of data into an existing buffer, which needs VK_BUFFER_USAGE_TRANSFER_DST_BIT.
+	//Uploads bigger than a staging segment are split over several batches. Returns the upload ticket
+	uint64_t upload_to_buffer(VkBuffer buffer, size_t offset, const void* data, size_t size);
+
+	//submits the open upload batch without waiting. draw() does this every frame, and anything
+	//submitted to the graphics queue afterwards sees the uploaded data
+	void submit_uploads();
+
+	//true once the copies of the upload with this ticket have finished on the GPU
+	bool is_upload_complete(uint64_t ticket);
+
+	//submits the open upload batch and waits until every queued upload has reached the GPU
+	void flush_uploads();
+
+	//an entity drawn with mesh and material at a fixed transform, outside the transform hierarchy
+	Entity create_renderable(Mesh* mesh, Material* material, const glm::mat4& transform);
+
+	//creates a GameObject under parent, or as a root when parent isn't alive. Its entity follows its transform node
+	Handle<GameObject> create_game_object(Mesh* mesh, Material* material, Handle<GameObject> parent = {});
+
+	//destroys the object and every object under it
+	void destroy_game_object(Handle<GameObject> handle);
+
+	//nullptr once the object was destroyed
+	GameObject* get_game_object(Handle<GameObject> handle) { return _gameObjects.get(handle); }
+
+	//destroys every GameObject and entity
+	void clear_scene();
+
+	//hides or shows an entity on every render path. Use this rather than writing its VisibilityComponent,
+	//it also marks the GPU scene for a rebuild
+	void set_visible(Entity entity, bool visible);
 
 
 
@@ -157,12 +436,11 @@ public:
 
 private:
 
-	GameObject gameObjects[100];
-	int gameObjectsIndex = 0;
-	GameObject* root[100];
-	int rootGameObjectsIndex = 0;
+	//every GameObject. Their addresses are stable, and handles to destroyed ones are detected
+	ObjectPool<GameObject> _gameObjects;
 
-	void add_to_root(GameObject go);
+	//set when an object was destroyed. The objects under it are destroyed with the next update_scene()
+	bool _gameObjectsDestroyed{ false };
 
 	void init_vulkan();
 
@@ -171,10 +449,92 @@ private:
 	void init_default_renderpass();
 
 	void init_framebuffers();
+
+	//headless replacement for the swapchain images
+	void init_offscreen_targets();
+
+	//rebuilds the swapchain, depth image and framebuffers at the current window size. Pipelines are untouched,
+	//their viewport and scissor are dynamic. Returns false while the window has no area
+	bool recreate_swapchain();
+
+	//viewport and scissor covering the whole window, needed by every command buffer that draws
+	void set_viewport(VkCommandBuffer cmd);
 	void init_sync_structures();
 
+	void init_descriptors();
+
 	void init_pipelines();
 
+	//background compilation of material pipelines, see create_material_async()
+	PipelineCompiler _pipelineCompiler;
+	std::vector<PendingMaterial> _pendingMaterials;
+
+	//deduplicates graphics pipelines by builder state. Every material pipeline goes through it
+	PipelineStateCache _pipelineStates;
+
+	//hands the pipelines of finished materials over to them. Called at the start of every frame
+	void resolve_pending_materials();
+
+	//small sort key id of a pipeline, shared by all materials that bind it
+	uint16_t get_pipeline_id(VkPipeline pipeline);
+
+	//shader modules by path, kept for the whole run since background compiles may still need them
+	std::unordered_map<std::string, VkShaderModule> _shaderModules;
+
+	VkShaderModule get_shader_module(const std::string& path);
+
+	//creates _pipelineCache from the cache file if it matches this GPU and driver, empty otherwise
+	void init_pipeline_cache();
+
+	//checks the VkPipelineCacheHeaderVersionOne header of cache file data against the device
+	static bool is_pipeline_cache_valid(const std::vector<char>& data, const VkPhysicalDeviceProperties& properties);
+
+	//writes the cache back to _pipelineCachePath
+	void save_pipeline_cache();
+
+	//true if the cache was created from a valid file
+	bool _pipelineCacheWarm{ false };
+
+	//optional device capabilities of the GPU-driven path
+	bool _gpuDrivenSupported{ false };
+	bool _multiDrawIndirectSupported{ false };
+	PFN_vkCmdDrawIndexedIndirectCountKHR _vkCmdDrawIndexedIndirectCount{ nullptr };
+
+	//the renderables as the GPU sees them: sorted into batches once, uploaded once
+	DrawList _gpuSceneList;
+	bool _gpuSceneDirty{ true };
+	std::vector<RenderObject> _gpuSceneObjects;
+	//_scene.structure_version() the GPU scene was built from
+	uint64_t _gpuSceneVersion{ UINT64_MAX };
+	AllocatedBuffer _gpuObjectBuffer;
+	AllocatedBuffer _gpuBatchBuffer;
+	uint32_t _gpuObjectCapacity{ 0 };
+	uint32_t _gpuBatchCapacity{ 0 };
+
+	//re-uploads objects and batches if the renderables changed since the last frame
+	void update_gpu_scene();
+
+	//records the culling dispatch and the barriers that make its output visible to indirect draws. Outside the render pass
+	void record_gpu_culling(FrameData& frame, VkCommandBuffer cmd);
+
+	//records one indirect draw per batch. Inside the render pass
+	DrawStats draw_gpu_driven(FrameData& frame, VkCommandBuffer cmd);
+
+	void update_camera();
+
+	//updates the world matrices that moved since last frame and copies them to the entities
+	void update_scene();
+
+	//culls the entities against this frame's camera and collects the visible ones into _renderables
+	void cull_scene();
+
+	//makes sure the frame's instance buffer can hold this frame's draw list and fills it
+	void upload_instances(FrameData& frame);
+
+	//splits the renderables into chunks and records each into its own secondary command buffer.
+	//returns how many secondary buffers of the frame were recorded
+	uint32_t record_secondary_draws(FrameData& frame, VkFramebuffer framebuffer);
+
 	bool load_shader_module(const char* filePath, VkShaderModule* outShaderModule);
 	
 	//other code ....
@@ -182,26 +542,17 @@ private:
 
 	void upload_mesh(Mesh& mesh);
 
-	void VulkanEngine::init_scene();
-
-};
-
+	//returns the batch uploads are recorded into, starting it if needed. Waits if its staging segment is still in use
+	UploadBatch& get_upload_batch();
 
+	//ends and submits the open batch, later uploads go to the next segment
+	void submit_upload_batch();
 
+	//sort key ids handed out so far
+	std::unordered_map<VkPipeline, uint16_t> _pipelineIds;
+	uint16_t _materialCount{ 0 };
+	uint16_t _meshCount{ 0 };
 
-class PipelineBuilder {
-public:
+	void VulkanEngine::init_scene();
 
-	std::vector<VkPipelineShaderStageCreateInfo> _shaderStages;
-	VkPipelineVertexInputStateCreateInfo _vertexInputInfo;
-	VkPipelineInputAssemblyStateCreateInfo _inputAssembly;
-	VkViewport _viewport;
-	VkRect2D _scissor;
-	VkPipelineRasterizationStateCreateInfo _rasterizer;
-	VkPipelineColorBlendAttachmentState _colorBlendAttachment;
-	VkPipelineMultisampleStateCreateInfo _multisampling;
-	VkPipelineLayout _pipelineLayout;
-	VkPipelineDepthStencilStateCreateInfo _depthStencil;
-
-	VkPipeline build_pipeline(VkDevice device, VkRenderPass pass);
-};
\ No newline at end of file
+};
@@ -0,0 +1,98 @@
+#include "vk_frame_stats.h"
+
+#include <algorithm>
+#include <cstdio>
+
+
+FrameStats::FrameStats()
+{
+	_frames.resize(FRAME_STATS_CAPACITY);
+	_scratch.reserve(FRAME_STATS_CAPACITY);
+}
+
+void FrameStats::add_frame(const FrameTiming& timing)
+{
+	_frames[_frameCount % FRAME_STATS_CAPACITY] = timing;
+	_frameCount++;
+}
+
+float FrameStats::metric_of(const FrameTiming& timing, FrameMetric metric)
+{
+	switch (metric) {
+	case FrameMetric::Wait:
+		return timing.waitMs;
+	case FrameMetric::Submit:
+		return timing.submitMs;
+	default:
+		return timing.frameMs;
+	}
+}
+
+FrameTimeSummary FrameStats::summarize(FrameMetric metric, uint32_t window) const
+{
+	FrameTimeSummary summary;
+
+	uint32_t count = (uint32_t)std::min<uint64_t>({ (uint64_t)window, (uint64_t)FRAME_STATS_CAPACITY, _frameCount });
+	if (count == 0) {
+		return summary;
+	}
+
+	_scratch.clear();
+	float sum = 0.f;
+	for (uint64_t i = _frameCount - count; i < _frameCount; i++) {
+		float value = metric_of(_frames[i % FRAME_STATS_CAPACITY], metric);
+		_scratch.push_back(value);
+		sum += value;
+	}
+	std::sort(_scratch.begin(), _scratch.end());
+
+	//nearest rank, so every percentile is a frame that actually happened
+	auto percentile = [&](float p) {
+		uint32_t rank = (uint32_t)(p * count + 0.999f);
+		return _scratch[std::min(std::max(rank, 1u), count) - 1];
+	};
+
+	summary.frames = count;
+	summary.averageMs = sum / count;
+	summary.p50Ms = percentile(0.50f);
+	summary.p95Ms = percentile(0.95f);
+	summary.p99Ms = percentile(0.99f);
+	summary.maxMs = _scratch.back();
+
+	//sorted, so the stutters are the tail past the threshold
+	float threshold = summary.p50Ms * _stutterFactor;
+	summary.stutters = (uint32_t)(_scratch.end() - std::upper_bound(_scratch.begin(), _scratch.end(), threshold));
+
+	return summary;
+}
+
+std::string FrameStats::summary_line(uint32_t window) const
+{
+	FrameTimeSummary frame = summarize(FrameMetric::Frame, window);
+	FrameTimeSummary wait = summarize(FrameMetric::Wait, window);
+	FrameTimeSummary submit = summarize(FrameMetric::Submit, window);
+
+	char line[256];
+	snprintf(line, sizeof(line), "Frame: %.1f fps | p50 %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms, %u stutters in %u frames | wait p50 %.3f ms, submit p50 %.3f ms",
+		frame.averageMs > 0.f ? 1000.f / frame.averageMs : 0.f, frame.p50Ms, frame.p95Ms, frame.p99Ms, frame.maxMs, frame.stutters, frame.frames,
+		wait.p50Ms, submit.p50Ms);
+	return line;
+}
+
+bool FrameStats::write_csv(const char* path) const
+{
+	FILE* file = fopen(path, "w");
+	if (!file) {
+		return false;
+	}
+
+	fprintf(file, "frame,frame_ms,wait_ms,submit_ms\n");
+
+	uint64_t first = _frameCount > FRAME_STATS_CAPACITY ? _frameCount - FRAME_STATS_CAPACITY : 0;
+	for (uint64_t i = first; i < _frameCount; i++) {
+		const FrameTiming& timing = _frames[i % FRAME_STATS_CAPACITY];
+		fprintf(file, "%llu,%.4f,%.4f,%.4f\n", (unsigned long long)i, timing.frameMs, timing.waitMs, timing.submitMs);
+	}
+
+	return fclose(file) == 0;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//frames FrameStats remembers. Windows longer than this are clamped to it
+constexpr uint32_t FRAME_STATS_CAPACITY = 1024;
+
+//CPU timings of one frame, in ms
+struct FrameTiming {
+	//from the end of the previous frame's draw() to the end of this one
+	float frameMs{ 0.f };
+	//blocked on the frame slot's fence and on acquiring the swapchain image
+	float waitMs{ 0.f };
+	//inside vkQueueSubmit and vkQueuePresentKHR
+	float submitMs{ 0.f };
+};
+
+enum class FrameMetric {
+	Frame,
+	Wait,
+	Submit
+};
+
+//distribution of one metric over the last frames
+struct FrameTimeSummary {
+	uint32_t frames{ 0 };
+	float averageMs{ 0.f };
+	float p50Ms{ 0.f };
+	float p95Ms{ 0.f };
+	float p99Ms{ 0.f };
+	float maxMs{ 0.f };
+	//frames that took more than the stutter factor times the window's median
+	uint32_t stutters{ 0 };
+};
+
+//keeps the timings of the last FRAME_STATS_CAPACITY frames. Adding a frame is constant time and never allocates,
+//the percentiles are only computed when asked for
+class FrameStats {
+public:
+	FrameStats();
+
+	void add_frame(const FrameTiming& timing);
+
+	//summary of the last window frames, or fewer if not that many were added yet
+	FrameTimeSummary summarize(FrameMetric metric, uint32_t window = FRAME_STATS_CAPACITY) const;
+
+	//frames added since the start, including those the ring has dropped
+	uint64_t frame_count() const { return _frameCount; }
+
+	//one line with the frame time distribution of the last window frames, and the wait and submit medians
+	std::string summary_line(uint32_t window = FRAME_STATS_CAPACITY) const;
+
+	//every frame still in the ring, oldest first, one row per frame
+	bool write_csv(const char* path) const;
+
+	//a frame stutters when it takes longer than this times the median of its window
+	float _stutterFactor{ 2.f };
+
+private:
+	static float metric_of(const FrameTiming& timing, FrameMetric metric);
+
+	std::vector<FrameTiming> _frames;
+	uint64_t _frameCount{ 0 };
+
+	//sorting space for summarize(), kept so asking every frame doesn't allocate
+	mutable std::vector<float> _scratch;
+};
@@ -1,17 +1,40 @@
 #pragma once
 
-#include <stack> 
-#include <map>
 #include "glm/glm.hpp"
 #include <vulkan/vulkan.h>
 #include <vk_mesh.h>
+#include "vk_transform.h"
+#include "vk_ecs.h"
 
 
 struct Material {
 	VkPipeline pipeline;
 	VkPipelineLayout pipelineLayout;
+
+	//variant of the pipeline that reads transforms from the instance buffer. Objects sharing a mesh
+	//and this material are drawn with one instanced draw. VK_NULL_HANDLE draws every object on its own
+	VkPipeline instancedPipeline;
+
+	//variant used by the GPU-driven path, reading transforms from the object storage buffer.
+	//Objects of materials without one are not drawn by that path
+	VkPipeline indirectPipeline;
+
+	//small ids used to build draw sort keys, assigned by create_material
+	uint16_t pipelineId;
+	uint16_t materialId;
+
+	//false while the pipelines of an async material are compiling. Its objects draw with the fallback
+	//material in the meantime, or not at all without one
+	Material* fallback{ nullptr };
+	bool ready{ true };
 };
 
+//the material an object is actually drawn with this frame, nullptr if it can't be drawn yet
+inline const Material* drawable_material(const Material* material)
+{
+	return material->ready ? material : material->fallback;
+}
+
 struct RenderObject {
 	Mesh* mesh;
 
@@ -25,24 +48,63 @@ struct MeshPushConstants {
 	glm::mat4 render_matrix;
 };
 
+//GPU-driven path data, laid out to match the std430 blocks in cull.comp and tri_mesh_indirect.vert
+
+struct GPUObjectData {
+	glm::mat4 model;
+	//bounding sphere in mesh space, xyz center and w radius
+	glm::vec4 sphereBounds;
+	uint32_t batchIndex;
+	uint32_t pad[3];
+};
+
+//one per (material, mesh) batch. Its draw commands start at commandOffset in the indirect buffer
+struct GPUBatchData {
+	uint32_t indexCount;
+	uint32_t firstIndex;
+	int32_t vertexOffset;
+	uint32_t commandOffset;
+};
 
-class GameObject {
-public:
-	
-	GameObject* parent;
-	RenderObject renderObject;
-	glm::mat4 get_global_matrix();
-	void move_object(glm::mat4 pose);
+struct GPUCullConstants {
+	glm::vec4 frustumPlanes[6];
+	uint32_t objectCount;
+	//1 packs visible draws per batch and writes the batch draw count, 0 writes one command per object
+	//with instanceCount 0 for culled ones, for devices without indirect count draws
+	uint32_t compact;
+};
 
-	void addChild(GameObject* go);
-	
 
-private:
-	int childrenIndex{ 0 };
-	std::map<int, GameObject*> children;
-	glm::mat4 transformMatrix;
-	glm::mat4 globalMatrixCache;
-	bool globalMatrixCacheValidity{ false };
-	void recurse_invalidate_cache(GameObject* go);
+//an object of the scene. Where it is, and what it hangs under, lives in the engine's TransformHierarchy,
+//what it looks like in the components of its entity
+struct GameObject {
+	TransformId transform{ INVALID_TRANSFORM };
+	Entity entity;
+};
+
+//components of renderable entities, see vk_render_systems.h for the systems that use them
+
+//world matrix. Entities with a hierarchy node get it copied from there every frame, the others keep what they were given
+struct TransformComponent {
+	glm::mat4 world{ 1.f };
+	TransformId node{ INVALID_TRANSFORM };
+};
+
+struct MeshComponent {
+	Mesh* mesh;
+};
+
+struct MaterialComponent {
+	Material* material;
+};
+
+//world space bounding sphere, xyz center and w radius
+struct BoundsComponent {
+	glm::vec4 sphere{ 0.f };
+};
 
+//lets gameplay hide an entity without destroying it, set through VulkanEngine::set_visible(). Frustum culling
+//doesn't write it, its result is the list of visible entities rendersys::cull() returns
+struct VisibilityComponent {
+	bool visible{ true };
 };
\ No newline at end of file
@@ -0,0 +1,173 @@
+#include "vk_geometry_pool.h"
+
+#include <algorithm>
+#include <iostream>
+
+
+void RangeAllocator::init(uint32_t capacity)
+{
+	_capacity = capacity;
+	_freeRanges.clear();
+	if (capacity > 0) {
+		_freeRanges[0] = capacity;
+	}
+}
+
+bool RangeAllocator::allocate(uint32_t count, uint32_t& offset)
+{
+	if (count == 0) {
+		offset = 0;
+		return true;
+	}
+
+	for (auto it = _freeRanges.begin(); it != _freeRanges.end(); it++) {
+		if (it->second < count) {
+			continue;
+		}
+
+		offset = it->first;
+		uint32_t remaining = it->second - count;
+		_freeRanges.erase(it);
+		if (remaining > 0) {
+			_freeRanges[offset + count] = remaining;
+		}
+		return true;
+	}
+
+	return false;
+}
+
+void RangeAllocator::free(uint32_t offset, uint32_t count)
+{
+	if (count == 0) {
+		return;
+	}
+
+	auto it = _freeRanges.emplace(offset, count).first;
+
+	//merge with the following range
+	auto next = std::next(it);
+	if (next != _freeRanges.end() && it->first + it->second == next->first) {
+		it->second += next->second;
+		_freeRanges.erase(next);
+	}
+
+	//and with the preceding one
+	if (it != _freeRanges.begin()) {
+		auto previous = std::prev(it);
+		if (previous->first + previous->second == it->first) {
+			previous->second += it->second;
+			_freeRanges.erase(it);
+		}
+	}
+}
+
+
+void GeometryPool::init(VmaAllocator allocator, uint32_t vertexStride, uint32_t blockVertices, uint32_t blockIndices)
+{
+	_allocator = allocator;
+	_vertexStride = vertexStride;
+	_blockVertices = blockVertices;
+	_blockIndices = blockIndices;
+}
+
+void GeometryPool::destroy()
+{
+	for (std::unique_ptr<GeometryBlock>& block : _blocks) {
+		vmaDestroyBuffer(_allocator, block->_vertexBuffer._buffer, block->_vertexBuffer._allocation);
+		vmaDestroyBuffer(_allocator, block->_indexBuffer._buffer, block->_indexBuffer._allocation);
+	}
+	_blocks.clear();
+	_pendingFrees.clear();
+}
+
+GeometryAllocation GeometryPool::allocate(uint32_t vertexCount, uint32_t indexCount)
+{
+	GeometryAllocation allocation;
+	allocation.vertexCount = vertexCount;
+	allocation.indexCount = indexCount;
+
+	for (std::unique_ptr<GeometryBlock>& block : _blocks) {
+		uint32_t firstVertex, firstIndex;
+		if (!block->_vertexRanges.allocate(vertexCount, firstVertex)) {
+			continue;
+		}
+		if (!block->_indexRanges.allocate(indexCount, firstIndex)) {
+			block->_vertexRanges.free(firstVertex, vertexCount);
+			continue;
+		}
+
+		allocation.block = block.get();
+		allocation.firstVertex = firstVertex;
+		allocation.firstIndex = firstIndex;
+		return allocation;
+	}
+
+	//meshes bigger than a block get a block of their own size
+	GeometryBlock* block = add_block(std::max(vertexCount, _blockVertices), std::max(indexCount, _blockIndices));
+	block->_vertexRanges.allocate(vertexCount, allocation.firstVertex);
+	block->_indexRanges.allocate(indexCount, allocation.firstIndex);
+	allocation.block = block;
+	return allocation;
+}
+
+void GeometryPool::free(const GeometryAllocation& allocation, uint64_t frameNumber)
+{
+	if (!allocation.block) {
+		return;
+	}
+	_pendingFrees.push_back(PendingFree{ allocation, frameNumber });
+}
+
+void GeometryPool::release_freed(uint64_t completedFrame)
+{
+	//blocks stay alive for the whole run even when empty, only the ranges go back
+	while (!_pendingFrees.empty() && _pendingFrees.front().frameNumber <= completedFrame) {
+		const GeometryAllocation& allocation = _pendingFrees.front().allocation;
+		for (std::unique_ptr<GeometryBlock>& block : _blocks) {
+			if (block.get() == allocation.block) {
+				block->_vertexRanges.free(allocation.firstVertex, allocation.vertexCount);
+				block->_indexRanges.free(allocation.firstIndex, allocation.indexCount);
+				break;
+			}
+		}
+		_pendingFrees.pop_front();
+	}
+}
+
+GeometryBlock* GeometryPool::add_block(uint32_t vertexCount, uint32_t indexCount)
+{
+	std::unique_ptr<GeometryBlock> block = std::make_unique<GeometryBlock>();
+
+	VmaAllocationCreateInfo vmaallocInfo = {};
+	vmaallocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+	//filled through the staging uploads, read by draws
+	VkBufferCreateInfo vertexBufferInfo = {};
+	vertexBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	vertexBufferInfo.size = (VkDeviceSize)vertexCount * _vertexStride;
+	vertexBufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+	VK_CHECK(vmaCreateBuffer(_allocator, &vertexBufferInfo, &vmaallocInfo,
+		&block->_vertexBuffer._buffer,
+		&block->_vertexBuffer._allocation,
+		nullptr));
+
+	VkBufferCreateInfo indexBufferInfo = {};
+	indexBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	indexBufferInfo.size = (VkDeviceSize)indexCount * sizeof(uint32_t);
+	indexBufferInfo.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+	VK_CHECK(vmaCreateBuffer(_allocator, &indexBufferInfo, &vmaallocInfo,
+		&block->_indexBuffer._buffer,
+		&block->_indexBuffer._allocation,
+		nullptr));
+
+	block->_vertexRanges.init(vertexCount);
+	block->_indexRanges.init(indexCount);
+
+	std::cout << "Geometry pool: new block of " << vertexCount << " vertices and " << indexCount << " indices" << std::endl;
+
+	_blocks.push_back(std::move(block));
+	return _blocks.back().get();
+}
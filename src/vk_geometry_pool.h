@@ -0,0 +1,85 @@
+#pragma once
+
+#include <vk_types.h>
+#include <deque>
+#include <map>
+#include <memory>
+#include <vector>
+
+
+//first-fit free list over [0, capacity) in whatever unit the caller uses. Neighbouring free ranges are merged on free
+class RangeAllocator {
+public:
+	void init(uint32_t capacity);
+
+	//returns false if no free range is big enough
+	bool allocate(uint32_t count, uint32_t& offset);
+
+	void free(uint32_t offset, uint32_t count);
+
+	uint32_t capacity() const { return _capacity; }
+
+private:
+	uint32_t _capacity{ 0 };
+	//free ranges, offset to size
+	std::map<uint32_t, uint32_t> _freeRanges;
+};
+
+//one device-local vertex buffer and index buffer that many meshes are sub-allocated from
+struct GeometryBlock {
+	AllocatedBuffer _vertexBuffer;
+	AllocatedBuffer _indexBuffer;
+	RangeAllocator _vertexRanges;
+	RangeAllocator _indexRanges;
+};
+
+//where a mesh lives in its pool. firstVertex is the vertexOffset of indexed draws, indices stay mesh-relative
+struct GeometryAllocation {
+	const GeometryBlock* block{ nullptr };
+	uint32_t firstVertex{ 0 };
+	uint32_t vertexCount{ 0 };
+	uint32_t firstIndex{ 0 };
+	uint32_t indexCount{ 0 };
+};
+
+//geometry of every mesh with one vertex layout, packed into a few large buffers so draws only rebind when the block changes.
+//A new block is added when a mesh doesn't fit in the existing ones
+class GeometryPool {
+public:
+	void init(VmaAllocator allocator, uint32_t vertexStride, uint32_t blockVertices, uint32_t blockIndices);
+
+	void destroy();
+
+	//reserves room for a mesh. The data still has to be uploaded into the block's buffers
+	GeometryAllocation allocate(uint32_t vertexCount, uint32_t indexCount);
+
+	//frames still in flight may be drawing from the allocation, so its ranges are only queued here, tagged with the
+	//frame that freed it. release_freed() hands them back once that frame is known to be done on the GPU
+	void free(const GeometryAllocation& allocation, uint64_t frameNumber);
+
+	//returns the ranges of every allocation freed in completedFrame or earlier to the blocks. Call it after waiting
+	//on the fence of completedFrame
+	void release_freed(uint64_t completedFrame);
+
+	uint32_t vertex_stride() const { return _vertexStride; }
+
+	size_t block_count() const { return _blocks.size(); }
+
+private:
+	GeometryBlock* add_block(uint32_t vertexCount, uint32_t indexCount);
+
+	VmaAllocator _allocator{ nullptr };
+	uint32_t _vertexStride{ 0 };
+	uint32_t _blockVertices{ 0 };
+	uint32_t _blockIndices{ 0 };
+
+	//blocks are never moved, meshes keep pointers to them
+	std::vector<std::unique_ptr<GeometryBlock>> _blocks;
+
+	struct PendingFree {
+		GeometryAllocation allocation;
+		uint64_t frameNumber;
+	};
+	//in the order they were freed, so frame numbers never decrease
+	std::deque<PendingFree> _pendingFrees;
+};
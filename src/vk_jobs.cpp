@@ -0,0 +1,334 @@
+#include "vk_jobs.h"
+#include "vk_trace.h"
+
+#include <string>
+
+
+//which deque the calling thread owns. -1 for threads the job system didn't start
+static thread_local int32_t tl_threadIndex = -1;
+
+//cheap per-thread random numbers for picking steal victims
+static thread_local uint32_t tl_randomState = 0x9E3779B9u;
+
+static uint32_t next_random()
+{
+	//xorshift32
+	uint32_t x = tl_randomState;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	tl_randomState = x;
+	return x;
+}
+
+
+bool WorkStealingQueue::push(Job* job)
+{
+	int64_t bottom = _bottom.load(std::memory_order_relaxed);
+	int64_t top = _top.load(std::memory_order_acquire);
+
+	if (bottom - top >= CAPACITY) {
+		return false;
+	}
+
+	_jobs[bottom & MASK].store(job, std::memory_order_relaxed);
+	//the job has to be visible before thieves can see the new bottom
+	std::atomic_thread_fence(std::memory_order_release);
+	_bottom.store(bottom + 1, std::memory_order_relaxed);
+	return true;
+}
+
+Job* WorkStealingQueue::pop()
+{
+	int64_t bottom = _bottom.load(std::memory_order_relaxed) - 1;
+	_bottom.store(bottom, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t top = _top.load(std::memory_order_relaxed);
+
+	if (top > bottom) {
+		//empty, put bottom back
+		_bottom.store(bottom + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	Job* job = _jobs[bottom & MASK].load(std::memory_order_relaxed);
+	if (top == bottom) {
+		//last job in the queue, race the thieves for it
+		if (!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+			job = nullptr;
+		}
+		_bottom.store(bottom + 1, std::memory_order_relaxed);
+	}
+	return job;
+}
+
+Job* WorkStealingQueue::steal()
+{
+	int64_t top = _top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t bottom = _bottom.load(std::memory_order_acquire);
+
+	if (top >= bottom) {
+		return nullptr;
+	}
+
+	Job* job = _jobs[top & MASK].load(std::memory_order_relaxed);
+	//someone else (the owner or another thief) may have taken it first
+	if (!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+		return nullptr;
+	}
+	return job;
+}
+
+
+void JobSystem::init(uint32_t threadCount)
+{
+	if (threadCount == 0) {
+		threadCount = std::thread::hardware_concurrency();
+	}
+	if (threadCount == 0) {
+		threadCount = 1;
+	}
+
+	_threadCount = threadCount;
+	_queues.reset(new WorkStealingQueue[threadCount]);
+	_stats.reset(new ThreadStats[threadCount]);
+	_running = true;
+
+	//the thread that initializes the system is thread 0 and works whenever it waits
+	tl_threadIndex = 0;
+
+	for (uint32_t i = 1; i < threadCount; i++) {
+		_threads.emplace_back([this, i]() { worker_loop(i); });
+	}
+}
+
+void JobSystem::shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(_sleepLock);
+		_running = false;
+	}
+	_wakeCondition.notify_all();
+
+	for (std::thread& thread : _threads) {
+		thread.join();
+	}
+	_threads.clear();
+
+	//anything still queued will never run, free it
+	for (uint32_t i = 0; i < _threadCount; i++) {
+		while (Job* job = _queues[i].steal()) {
+			delete job;
+		}
+	}
+	for (Job* job : _sharedQueue) {
+		delete job;
+	}
+	_sharedQueue.clear();
+
+	tl_threadIndex = -1;
+	_threadCount = 0;
+}
+
+int32_t JobSystem::thread_index()
+{
+	return tl_threadIndex;
+}
+
+uint64_t JobSystem::steal_count() const
+{
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < _threadCount; i++) {
+		total += _stats[i].stolen.load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+uint64_t JobSystem::executed_count() const
+{
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < _threadCount; i++) {
+		total += _stats[i].executed.load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+void JobSystem::run(std::function<void()>&& function, JobCounter* signal, JobCounter* dependency)
+{
+	Job* job = new Job{ std::move(function), signal };
+
+	if (signal) {
+		signal->_value.fetch_add(1);
+	}
+
+	if (dependency) {
+		//checked under the lock so the job can't miss the counter reaching zero
+		std::lock_guard<std::mutex> lock(dependency->_continuationLock);
+		if (dependency->_value.load() > 0) {
+			dependency->_continuations.push_back(job);
+			return;
+		}
+	}
+
+	enqueue(job);
+}
+
+void JobSystem::parallel_for(uint32_t count, uint32_t groupSize, std::function<void(uint32_t, uint32_t)>&& function, JobCounter* signal, JobCounter* dependency)
+{
+	if (count == 0) {
+		return;
+	}
+	if (groupSize == 0) {
+		groupSize = 1;
+	}
+
+	//the groups share one copy of the function
+	auto shared = std::make_shared<std::function<void(uint32_t, uint32_t)>>(std::move(function));
+
+	for (uint32_t begin = 0; begin < count; begin += groupSize) {
+		uint32_t end = begin + groupSize < count ? begin + groupSize : count;
+		run([shared, begin, end]() { (*shared)(begin, end); }, signal, dependency);
+	}
+}
+
+void JobSystem::wait(JobCounter* counter)
+{
+	int32_t threadIndex = tl_threadIndex;
+
+	while (!counter->is_done()) {
+		//help instead of blocking. This is also what keeps nested waits from deadlocking
+		Job* job = find_job(threadIndex);
+		if (job) {
+			execute(job, threadIndex);
+		}
+		else {
+			std::this_thread::yield();
+		}
+	}
+}
+
+void JobSystem::enqueue(Job* job)
+{
+	int32_t threadIndex = tl_threadIndex;
+
+	//counted before it becomes visible, so a sleeping worker can't miss it
+	_queuedJobs.fetch_add(1);
+
+	if (threadIndex < 0 || !_queues[threadIndex].push(job)) {
+		std::lock_guard<std::mutex> lock(_sharedQueueLock);
+		_sharedQueue.push_back(job);
+	}
+
+	if (_sleepingWorkers.load() > 0) {
+		//taking the lock orders this with a worker that is about to sleep
+		{
+			std::lock_guard<std::mutex> lock(_sleepLock);
+		}
+		_wakeCondition.notify_one();
+	}
+}
+
+Job* JobSystem::find_job(int32_t threadIndex)
+{
+	Job* job = nullptr;
+
+	if (threadIndex >= 0) {
+		job = _queues[threadIndex].pop();
+	}
+
+	if (!job && _threadCount > 1) {
+		//start at a random victim so thieves spread out
+		uint32_t start = next_random() % _threadCount;
+		for (uint32_t i = 0; i < _threadCount && !job; i++) {
+			uint32_t victim = (start + i) % _threadCount;
+			if ((int32_t)victim == threadIndex) {
+				continue;
+			}
+			job = _queues[victim].steal();
+		}
+		if (job && threadIndex >= 0) {
+			_stats[threadIndex].stolen.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	if (!job) {
+		std::lock_guard<std::mutex> lock(_sharedQueueLock);
+		if (!_sharedQueue.empty()) {
+			job = _sharedQueue.front();
+			_sharedQueue.pop_front();
+		}
+	}
+
+	if (job) {
+		_queuedJobs.fetch_sub(1);
+	}
+	return job;
+}
+
+void JobSystem::execute(Job* job, int32_t threadIndex)
+{
+	job->_function();
+
+	if (threadIndex >= 0) {
+		_stats[threadIndex].executed.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	JobCounter* signal = job->_signal;
+	delete job;
+
+	if (signal) {
+		signal->_releasing.fetch_add(1);
+		if (signal->_value.fetch_sub(1) == 1) {
+			release_continuations(signal);
+		}
+		//last touch of the counter, a waiter may destroy it after this
+		signal->_releasing.fetch_sub(1);
+	}
+}
+
+void JobSystem::release_continuations(JobCounter* counter)
+{
+	std::vector<Job*> ready;
+	{
+		std::lock_guard<std::mutex> lock(counter->_continuationLock);
+		ready.swap(counter->_continuations);
+	}
+
+	for (Job* job : ready) {
+		enqueue(job);
+	}
+}
+
+void JobSystem::worker_loop(uint32_t threadIndex)
+{
+	tl_threadIndex = (int32_t)threadIndex;
+	tl_randomState = 0x9E3779B9u * (threadIndex + 1);
+
+#if VK_TRACE_ENABLED
+	VK_TRACE_THREAD_NAME(("job worker " + std::to_string(threadIndex)).c_str());
+#endif
+
+	uint32_t idleRounds = 0;
+
+	while (_running.load()) {
+		Job* job = find_job((int32_t)threadIndex);
+		if (job) {
+			execute(job, (int32_t)threadIndex);
+			idleRounds = 0;
+			continue;
+		}
+
+		//spin briefly, new work usually shows up within a frame
+		if (++idleRounds < 64) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(_sleepLock);
+		_sleepingWorkers.fetch_add(1);
+		_wakeCondition.wait(lock, [this]() { return _queuedJobs.load() > 0 || !_running.load(); });
+		_sleepingWorkers.fetch_sub(1);
+		idleRounds = 0;
+	}
+}
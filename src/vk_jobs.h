@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+
+struct Job;
+
+//counts unfinished jobs. Every job signalling the counter adds one when it is queued and removes one when it is done,
+//so a counter at zero means all of its work has finished. Jobs can also be queued to start only once a counter hits zero
+struct JobCounter {
+	std::atomic<int32_t> _value{ 0 };
+	//threads that are still between decrementing _value and letting go of the counter.
+	//Waiting on this too means the counter can be destroyed as soon as wait() returns
+	std::atomic<int32_t> _releasing{ 0 };
+
+	bool is_done() const { return _value.load() == 0 && _releasing.load() == 0; }
+
+	//jobs waiting on this counter. They are queued when it reaches zero
+	std::mutex _continuationLock;
+	std::vector<Job*> _continuations;
+};
+
+struct Job {
+	std::function<void()> _function;
+	JobCounter* _signal;
+};
+
+//fixed size Chase-Lev deque. The owning thread pushes and pops at the bottom (LIFO, good for cache reuse),
+//every other thread steals from the top (FIFO, takes the oldest and usually biggest pieces of work)
+class WorkStealingQueue {
+public:
+	static constexpr int64_t CAPACITY = 4096;
+
+	//owner only. Returns false if the queue is full
+	bool push(Job* job);
+
+	//owner only
+	Job* pop();
+
+	//any thread
+	Job* steal();
+
+private:
+	static constexpr int64_t MASK = CAPACITY - 1;
+
+	alignas(64) std::atomic<int64_t> _top{ 0 };
+	alignas(64) std::atomic<int64_t> _bottom{ 0 };
+	alignas(64) std::atomic<Job*> _jobs[CAPACITY];
+};
+
+//work stealing task scheduler. Every thread, including the one that called init(), owns a deque of jobs.
+//Idle threads steal from the others, and threads that wait on a counter run jobs until it is done instead of blocking
+class JobSystem {
+public:
+
+	//threadCount includes the calling thread, which becomes thread 0. 0 picks the hardware concurrency
+	void init(uint32_t threadCount = 0);
+
+	void shutdown();
+
+	//queues a job. If signal is set it is incremented now and decremented once the job has run.
+	//If dependency is set the job is held back until that counter reaches zero
+	void run(std::function<void()>&& function, JobCounter* signal = nullptr, JobCounter* dependency = nullptr);
+
+	//splits [0, count) into groups of groupSize and queues fn(begin, end) for each group
+	void parallel_for(uint32_t count, uint32_t groupSize, std::function<void(uint32_t, uint32_t)>&& function, JobCounter* signal, JobCounter* dependency = nullptr);
+
+	//returns once the counter reaches zero. The calling thread runs queued jobs while it waits
+	void wait(JobCounter* counter);
+
+	//number of threads jobs run on, including the one that called init()
+	uint32_t thread_count() const { return _threadCount; }
+
+	//index of the calling thread in [0, thread_count()), or -1 for threads the system doesn't know
+	static int32_t thread_index();
+
+	//how many jobs were taken from another thread's deque since init()
+	uint64_t steal_count() const;
+
+	//how many jobs have run since init()
+	uint64_t executed_count() const;
+
+private:
+
+	void worker_loop(uint32_t threadIndex);
+
+	//pushes a job whose dependencies are satisfied to the calling thread's deque
+	void enqueue(Job* job);
+
+	//looks for work in the local deque, then in the other threads' deques, then in the shared queue
+	Job* find_job(int32_t threadIndex);
+
+	void execute(Job* job, int32_t threadIndex);
+
+	//queues every job that was waiting on the counter
+	void release_continuations(JobCounter* counter);
+
+	struct alignas(64) ThreadStats {
+		std::atomic<uint64_t> executed{ 0 };
+		std::atomic<uint64_t> stolen{ 0 };
+	};
+
+	uint32_t _threadCount{ 0 };
+	std::unique_ptr<WorkStealingQueue[]> _queues;
+	std::unique_ptr<ThreadStats[]> _stats;
+	std::vector<std::thread> _threads;
+
+	//threads that don't own a deque submit here
+	std::mutex _sharedQueueLock;
+	std::deque<Job*> _sharedQueue;
+
+	//workers go to sleep when there is nothing to steal for a while
+	std::atomic<int64_t> _queuedJobs{ 0 };
+	std::atomic<uint32_t> _sleepingWorkers{ 0 };
+	std::mutex _sleepLock;
+	std::condition_variable _wakeCondition;
+	std::atomic<bool> _running{ false };
+};
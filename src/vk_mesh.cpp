@@ -1,14 +1,87 @@
 #include <vk_mesh.h>
+#include <vk_trace.h>
 //just that for now
 
 
 //make sure that you are including the library
 #include <tiny_obj_loader.h>
 #include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <glm/geometric.hpp>
+#include <glm/common.hpp>
+#include <glm/exponential.hpp>
+#include <glm/vec2.hpp>
+
+
+namespace {
+
+	//open addressing table from vertex contents to where that vertex is in the mesh. Keyed on the values rather
+	//than the tinyobj index triple, so a file that stores the same position, normal and uv more than once still
+	//gets each distinct vertex once. Vertices compare bit for bit
+	class VertexTable {
+	public:
+		VertexTable(const std::vector<Vertex>& vertices, size_t expectedKeys)
+			: _vertices(vertices)
+		{
+			//keep the load factor under one half so probe sequences stay short
+			size_t capacity = 16;
+			while (capacity < expectedKeys * 2) {
+				capacity <<= 1;
+			}
+			_slots.assign(capacity, EMPTY);
+			_mask = capacity - 1;
+		}
+
+		//returns the index of an equal vertex already in the mesh, or stores newIndex, which vertex has to be
+		//appended at, and sets inserted
+		uint32_t find_or_insert(const Vertex& vertex, uint32_t newIndex, bool& inserted)
+		{
+			size_t slot = hash(vertex) & _mask;
+			while (true) {
+				uint32_t& entry = _slots[slot];
+				if (entry == EMPTY) {
+					entry = newIndex;
+					inserted = true;
+					return newIndex;
+				}
+				if (memcmp(&_vertices[entry], &vertex, sizeof(Vertex)) == 0) {
+					inserted = false;
+					return entry;
+				}
+				slot = (slot + 1) & _mask;
+			}
+		}
+
+	private:
+		static constexpr uint32_t EMPTY = UINT32_MAX;
+
+		static_assert(sizeof(Vertex) == 9 * sizeof(float), "Vertex has padding, memcmp would compare it");
+
+		static uint32_t hash(const Vertex& vertex)
+		{
+			uint32_t words[9];
+			memcpy(words, &vertex, sizeof(words));
+
+			uint32_t h = 0x811C9DC5u;
+			for (uint32_t word : words) {
+				h = (h ^ word) * 0x9E3779B1u;
+				h ^= h >> 15;
+			}
+			return h;
+		}
+
+		const std::vector<Vertex>& _vertices;
+		std::vector<uint32_t> _slots;
+		size_t _mask;
+	};
+}
 
 
 bool Mesh::load_from_obj(const char* filename)
 {
+	VK_TRACE_ZONE("load_from_obj");
+
 	//attrib will contain the vertex arrays of the file
 	tinyobj::attrib_t attrib;
 	//shapes contains the info for each separate object in the file
@@ -33,6 +106,18 @@ bool Mesh::load_from_obj(const char* filename)
 		return false;
 	}
 
+	size_t indexCount = 0;
+	for (const tinyobj::shape_t& shape : shapes) {
+		indexCount += shape.mesh.indices.size();
+	}
+
+	_vertices.clear();
+	_indices.clear();
+	_indices.reserve(indexCount);
+
+	//faces share most of their corners, so every distinct vertex is only stored once
+	VertexTable uniqueVertices(_vertices, indexCount);
+
 	// Loop over shapes
 	for (size_t s = 0; s < shapes.size(); s++) {
 		// Loop over faces(polygon)
@@ -69,16 +154,140 @@ bool Mesh::load_from_obj(const char* filename)
 				//we are setting the vertex color as the vertex normal. This is just for display purposes
 				new_vert.color = new_vert.normal;
 
+				bool inserted;
+				uint32_t vertexIndex = uniqueVertices.find_or_insert(new_vert, (uint32_t)_vertices.size(), inserted);
+				_indices.push_back(vertexIndex);
 
-				_vertices.push_back(new_vert);
+				if (inserted) {
+					_vertices.push_back(new_vert);
+				}
 			}
 			index_offset += fv;
 		}
 	}
 
+	std::cout << "Loaded " << filename << ": " << _indices.size() << " -> " << _vertices.size() << " vertices";
+	if (!_vertices.empty()) {
+		std::cout << " (" << (float)_indices.size() / (float)_vertices.size() << "x fewer)";
+	}
+	std::cout << std::endl;
+
+	compute_bounds();
+
 	return true;
 }
 
+void Mesh::compute_bounds()
+{
+	if (_vertices.empty()) {
+		_bounds = {};
+		return;
+	}
+
+	glm::vec3 minPos = _vertices[0].position;
+	glm::vec3 maxPos = _vertices[0].position;
+	for (const Vertex& vertex : _vertices) {
+		minPos = glm::min(minPos, vertex.position);
+		maxPos = glm::max(maxPos, vertex.position);
+	}
+
+	_bounds.origin = (maxPos + minPos) * 0.5f;
+	_bounds.extents = (maxPos - minPos) * 0.5f;
+
+	//the sphere is centered on the box, its radius is the farthest vertex from there
+	float radiusSquared = 0.f;
+	for (const Vertex& vertex : _vertices) {
+		glm::vec3 offset = vertex.position - _bounds.origin;
+		radiusSquared = glm::max(radiusSquared, glm::dot(offset, offset));
+	}
+	_bounds.radius = glm::sqrt(radiusSquared);
+}
+
+namespace {
+
+	int16_t to_snorm16(float value)
+	{
+		return (int16_t)glm::round(glm::clamp(value, -1.f, 1.f) * 32767.f);
+	}
+
+	uint8_t to_unorm8(float value)
+	{
+		return (uint8_t)glm::round(glm::clamp(value, 0.f, 1.f) * 255.f);
+	}
+
+	//maps the unit sphere onto the [-1, 1] square, the lower hemisphere folded over the diagonals
+	glm::vec2 oct_encode(glm::vec3 normal)
+	{
+		normal /= glm::abs(normal.x) + glm::abs(normal.y) + glm::abs(normal.z);
+
+		glm::vec2 encoded = glm::vec2(normal.x, normal.y);
+		if (normal.z < 0.f) {
+			glm::vec2 sign = glm::vec2(encoded.x >= 0.f ? 1.f : -1.f, encoded.y >= 0.f ? 1.f : -1.f);
+			encoded = (1.f - glm::abs(glm::vec2(encoded.y, encoded.x))) * sign;
+		}
+		return encoded;
+	}
+
+	//adds the per-instance InstanceData stream on binding 1 to a vertex layout
+	void add_instance_binding(VertexInputDescription& description)
+	{
+		//second binding advances once per instance instead of once per vertex
+		VkVertexInputBindingDescription instanceBinding = {};
+		instanceBinding.binding = 1;
+		instanceBinding.stride = sizeof(InstanceData);
+		instanceBinding.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+		description.bindings.push_back(instanceBinding);
+
+		//a mat4 attribute takes 4 locations, one per column. The model matrix will be stored at Locations 3 to 6
+		for (uint32_t column = 0; column < 4; column++) {
+			VkVertexInputAttributeDescription modelAttribute = {};
+			modelAttribute.binding = 1;
+			modelAttribute.location = 3 + column;
+			modelAttribute.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+			modelAttribute.offset = offsetof(InstanceData, model) + column * sizeof(glm::vec4);
+
+			description.attributes.push_back(modelAttribute);
+		}
+	}
+}
+
+std::vector<CompactVertex> Mesh::quantize()
+{
+	//one scale for all axes keeps the dequantization in a single vec4
+	float scale = glm::max(_bounds.extents.x, glm::max(_bounds.extents.y, _bounds.extents.z));
+	if (scale <= 0.f) {
+		scale = 1.f;
+	}
+	_dequantization = glm::vec4(_bounds.origin, scale);
+
+	std::vector<CompactVertex> compact(_vertices.size());
+	for (size_t i = 0; i < _vertices.size(); i++) {
+		const Vertex& vertex = _vertices[i];
+		CompactVertex& out = compact[i];
+
+		glm::vec3 position = (vertex.position - _bounds.origin) / scale;
+		out.position[0] = to_snorm16(position.x);
+		out.position[1] = to_snorm16(position.y);
+		out.position[2] = to_snorm16(position.z);
+		out.position[3] = 0;
+
+		glm::vec2 normal = glm::vec2(0.f);
+		if (glm::dot(vertex.normal, vertex.normal) > 0.f) {
+			normal = oct_encode(vertex.normal);
+		}
+		out.normal[0] = to_snorm16(normal.x);
+		out.normal[1] = to_snorm16(normal.y);
+
+		out.color[0] = to_unorm8(vertex.color.r);
+		out.color[1] = to_unorm8(vertex.color.g);
+		out.color[2] = to_unorm8(vertex.color.b);
+		out.color[3] = 255;
+	}
+
+	return compact;
+}
+
 VertexInputDescription Vertex::get_vertex_description()
 {
 	VertexInputDescription description;
@@ -116,4 +325,54 @@ VertexInputDescription Vertex::get_vertex_description()
 	description.attributes.push_back(normalAttribute);
 	description.attributes.push_back(colorAttribute);
 	return description;
-}
\ No newline at end of file
+}
+
+VertexInputDescription Vertex::get_instanced_vertex_description()
+{
+	VertexInputDescription description = get_vertex_description();
+	add_instance_binding(description);
+	return description;
+}
+
+VertexInputDescription CompactVertex::get_vertex_description()
+{
+	VertexInputDescription description;
+
+	VkVertexInputBindingDescription mainBinding = {};
+	mainBinding.binding = 0;
+	mainBinding.stride = sizeof(CompactVertex);
+	mainBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+	description.bindings.push_back(mainBinding);
+
+	//same locations as Vertex, so the shaders only differ in how they decode them
+	VkVertexInputAttributeDescription positionAttribute = {};
+	positionAttribute.binding = 0;
+	positionAttribute.location = 0;
+	positionAttribute.format = VK_FORMAT_R16G16B16A16_SNORM;
+	positionAttribute.offset = offsetof(CompactVertex, position);
+
+	VkVertexInputAttributeDescription normalAttribute = {};
+	normalAttribute.binding = 0;
+	normalAttribute.location = 1;
+	normalAttribute.format = VK_FORMAT_R16G16_SNORM;
+	normalAttribute.offset = offsetof(CompactVertex, normal);
+
+	VkVertexInputAttributeDescription colorAttribute = {};
+	colorAttribute.binding = 0;
+	colorAttribute.location = 2;
+	colorAttribute.format = VK_FORMAT_R8G8B8A8_UNORM;
+	colorAttribute.offset = offsetof(CompactVertex, color);
+
+	description.attributes.push_back(positionAttribute);
+	description.attributes.push_back(normalAttribute);
+	description.attributes.push_back(colorAttribute);
+	return description;
+}
+
+VertexInputDescription CompactVertex::get_instanced_vertex_description()
+{
+	VertexInputDescription description = get_vertex_description();
+	add_instance_binding(description);
+	return description;
+}
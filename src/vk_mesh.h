@@ -1,8 +1,11 @@
 #pragma once
 
 #include <vk_types.h>
+#include <vk_geometry_pool.h>
 #include <vector>
 #include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
 
 
 struct VertexInputDescription {
@@ -20,11 +23,66 @@ struct Vertex {
     glm::vec3 color;
 
     static VertexInputDescription get_vertex_description();
+
+    //the regular vertex layout plus a per-instance InstanceData stream on binding 1
+    static VertexInputDescription get_instanced_vertex_description();
+};
+
+//16 byte alternative to Vertex for big meshes. Positions are snorm16 inside the mesh bounds, normals octahedral snorm16
+//and colors unorm8. The vertex shaders decode it when their COMPACT_VERTICES specialization constant is set
+struct CompactVertex {
+
+    int16_t position[4];
+    int16_t normal[2];
+    uint8_t color[4];
+
+    static VertexInputDescription get_vertex_description();
+
+    static VertexInputDescription get_instanced_vertex_description();
+};
+
+enum class VertexFormat {
+    Full,
+    Compact
+};
+
+//per-instance data read by instanced pipelines, one per drawn object
+struct InstanceData {
+    glm::mat4 model;
+};
+
+//bounds of a mesh in its own space, used for culling
+struct MeshBounds {
+    glm::vec3 origin;
+    float radius;
+    glm::vec3 extents;
 };
 
 struct Mesh {
     std::vector<Vertex> _vertices;
+    std::vector<uint32_t> _indices;
+
+    MeshBounds _bounds;
+
+    //the mesh's range in the geometry pool of its vertex format, set when it is uploaded
+    GeometryAllocation _geometry;
 
-    AllocatedBuffer _vertexBuffer;
+    //small id used to build draw sort keys, assigned when the mesh is uploaded
+    uint16_t _meshId{ 0 };
+
+    //layout of the vertex buffer on the GPU. _vertices always keeps full precision.
+    //Compact meshes have to be drawn with a material built for CompactVertex
+    VertexFormat _vertexFormat{ VertexFormat::Full };
+
+    //position = quantized * w + xyz for compact meshes, pushed as MeshPushConstants::data
+    glm::vec4 _dequantization{ 0.f, 0.f, 0.f, 1.f };
+
+    //loads the triangles of an OBJ file, sharing one vertex between all the corners that use it
     bool load_from_obj(const char* filename);
+
+    //fits an AABB and a bounding sphere around the vertices
+    void compute_bounds();
+
+    //encodes _vertices as CompactVertex and sets _dequantization. Needs the bounds
+    std::vector<CompactVertex> quantize();
 };
\ No newline at end of file
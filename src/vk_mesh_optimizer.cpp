@@ -0,0 +1,327 @@
+#include "vk_mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <glm/geometric.hpp>
+
+
+namespace {
+
+	//tuning values from Forsyth's article. The cache size is what the scores assume, not what the hardware has
+	constexpr uint32_t FORSYTH_CACHE_SIZE = 32;
+	constexpr float CACHE_DECAY_POWER = 1.5f;
+	constexpr float LAST_TRIANGLE_SCORE = 0.75f;
+	constexpr float VALENCE_BOOST_SCALE = 2.0f;
+	constexpr float VALENCE_BOOST_POWER = 0.5f;
+
+	float vertex_score(int32_t cachePosition, uint32_t remainingTriangles)
+	{
+		//nothing left to draw with this vertex
+		if (remainingTriangles == 0) {
+			return -1.0f;
+		}
+
+		float score = 0.0f;
+		if (cachePosition >= 0) {
+			if (cachePosition < 3) {
+				//the last triangle's vertices get a fixed score, so the next triangle doesn't only depend on where they were in it
+				score = LAST_TRIANGLE_SCORE;
+			}
+			else {
+				float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+				score = std::pow(1.0f - (cachePosition - 3) * scaler, CACHE_DECAY_POWER);
+			}
+		}
+
+		//vertices with few triangles left are boosted, so lone triangles get finished instead of left behind
+		score += VALENCE_BOOST_SCALE * std::pow((float)remainingTriangles, -VALENCE_BOOST_POWER);
+		return score;
+	}
+
+	//FIFO post-transform cache. A vertex is cached if fewer than cacheSize misses happened since it was last loaded
+	class FifoCache {
+	public:
+		FifoCache(size_t vertexCount, uint32_t cacheSize)
+			: _timestamps(vertexCount, 0), _cacheSize(cacheSize), _time(cacheSize + 1) {}
+
+		//returns how many of the triangle's vertices had to be transformed
+		uint32_t access_triangle(const uint32_t* triangle)
+		{
+			uint32_t misses = 0;
+			for (int i = 0; i < 3; i++) {
+				uint32_t vertex = triangle[i];
+				if (_time - _timestamps[vertex] > _cacheSize) {
+					_timestamps[vertex] = _time++;
+					misses++;
+				}
+			}
+			return misses;
+		}
+
+	private:
+		std::vector<uint32_t> _timestamps;
+		uint32_t _cacheSize;
+		uint32_t _time;
+	};
+}
+
+
+meshopt::VertexCacheStats meshopt::analyze_vertex_cache(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize)
+{
+	VertexCacheStats stats = {};
+
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0 || vertexCount == 0) {
+		return stats;
+	}
+
+	FifoCache cache(vertexCount, cacheSize);
+	for (size_t t = 0; t < triangleCount; t++) {
+		stats.verticesTransformed += cache.access_triangle(&indices[t * 3]);
+	}
+
+	stats.acmr = (float)stats.verticesTransformed / (float)triangleCount;
+	stats.atvr = (float)stats.verticesTransformed / (float)vertexCount;
+	return stats;
+}
+
+
+void meshopt::optimize_vertex_cache(std::vector<uint32_t>& indices, size_t vertexCount)
+{
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0) {
+		return;
+	}
+
+	//triangles using each vertex, packed into one array
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+	for (uint32_t index : indices) {
+		adjacencyOffsets[index + 1]++;
+	}
+	for (size_t v = 0; v < vertexCount; v++) {
+		adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+	}
+
+	std::vector<uint32_t> adjacency(indices.size());
+	std::vector<uint32_t> adjacencyFill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (size_t i = 0; i < indices.size(); i++) {
+		adjacency[adjacencyFill[indices[i]]++] = (uint32_t)(i / 3);
+	}
+
+	std::vector<uint32_t> remainingTriangles(vertexCount);
+	std::vector<int32_t> cachePositions(vertexCount, -1);
+	std::vector<float> vertexScores(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++) {
+		remainingTriangles[v] = adjacencyOffsets[v + 1] - adjacencyOffsets[v];
+		vertexScores[v] = vertex_score(-1, remainingTriangles[v]);
+	}
+
+	std::vector<float> triangleScores(triangleCount);
+	std::vector<bool> emitted(triangleCount, false);
+	size_t best = 0;
+	for (size_t t = 0; t < triangleCount; t++) {
+		triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+		if (triangleScores[t] > triangleScores[best]) {
+			best = t;
+		}
+	}
+
+	std::vector<uint32_t> result;
+	result.reserve(indices.size());
+
+	//the triangle's vertices go in first, so the cache can briefly hold 3 more than its size
+	uint32_t cache[FORSYTH_CACHE_SIZE + 3];
+	uint32_t newCache[FORSYTH_CACHE_SIZE + 3];
+	uint32_t cacheCount = 0;
+	size_t cursor = 0;
+
+	for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++) {
+
+		//no cached vertex touches a remaining triangle, carry on with the next one in the original order
+		if (best == SIZE_MAX) {
+			while (emitted[cursor]) {
+				cursor++;
+			}
+			best = cursor;
+		}
+
+		const uint32_t* triangle = &indices[best * 3];
+		result.insert(result.end(), triangle, triangle + 3);
+		emitted[best] = true;
+
+		//the triangle's vertices move to the front of the cache, everything else shifts back
+		uint32_t newCount = 0;
+		for (int i = 0; i < 3; i++) {
+			remainingTriangles[triangle[i]]--;
+
+			//degenerate triangles would put a vertex in twice
+			if (std::find(newCache, newCache + newCount, triangle[i]) == newCache + newCount) {
+				newCache[newCount++] = triangle[i];
+			}
+		}
+		for (uint32_t i = 0; i < cacheCount; i++) {
+			uint32_t vertex = cache[i];
+			if (vertex != triangle[0] && vertex != triangle[1] && vertex != triangle[2]) {
+				newCache[newCount++] = vertex;
+			}
+		}
+
+		//rescore everything that moved, including the vertices that just fell out of the cache
+		for (uint32_t i = 0; i < newCount; i++) {
+			uint32_t vertex = newCache[i];
+			cachePositions[vertex] = i < FORSYTH_CACHE_SIZE ? (int32_t)i : -1;
+
+			float score = vertex_score(cachePositions[vertex], remainingTriangles[vertex]);
+			float delta = score - vertexScores[vertex];
+			vertexScores[vertex] = score;
+
+			for (uint32_t a = adjacencyOffsets[vertex]; a < adjacencyOffsets[vertex + 1]; a++) {
+				triangleScores[adjacency[a]] += delta;
+			}
+		}
+
+		cacheCount = std::min(newCount, FORSYTH_CACHE_SIZE);
+		std::copy(newCache, newCache + cacheCount, cache);
+
+		//only triangles touching the cache changed score, so the next one is picked from those
+		best = SIZE_MAX;
+		float bestScore = -1.0f;
+		for (uint32_t i = 0; i < cacheCount; i++) {
+			uint32_t vertex = cache[i];
+			for (uint32_t a = adjacencyOffsets[vertex]; a < adjacencyOffsets[vertex + 1]; a++) {
+				uint32_t t = adjacency[a];
+				if (!emitted[t] && triangleScores[t] > bestScore) {
+					best = t;
+					bestScore = triangleScores[t];
+				}
+			}
+		}
+	}
+
+	indices.swap(result);
+}
+
+
+void meshopt::optimize_overdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, uint32_t cacheSize)
+{
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0) {
+		return;
+	}
+
+	struct Cluster {
+		uint32_t firstTriangle;
+		uint32_t triangleCount;
+		glm::vec3 centroidSum;
+		glm::vec3 normalSum;
+		float area;
+		float sortKey;
+	};
+
+	//a triangle that misses on all three vertices starts a new cluster. The cache is cold there anyway,
+	//so moving the cluster elsewhere costs at most a few misses
+	std::vector<Cluster> clusters;
+	FifoCache cache(vertices.size(), cacheSize);
+
+	glm::vec3 meshCentroidSum{ 0.f };
+	float meshArea = 0.f;
+
+	for (size_t t = 0; t < triangleCount; t++) {
+		const uint32_t* triangle = &indices[t * 3];
+		if (cache.access_triangle(triangle) == 3 || clusters.empty()) {
+			clusters.push_back({ (uint32_t)t, 0, glm::vec3{ 0.f }, glm::vec3{ 0.f }, 0.f, 0.f });
+		}
+
+		const glm::vec3& a = vertices[triangle[0]].position;
+		const glm::vec3& b = vertices[triangle[1]].position;
+		const glm::vec3& c = vertices[triangle[2]].position;
+
+		//the cross product points along the normal and is as long as twice the area, so it also weights the sums
+		glm::vec3 normal = glm::cross(b - a, c - a);
+		float area = glm::length(normal);
+		glm::vec3 centroid = (a + b + c) / 3.f;
+
+		Cluster& cluster = clusters.back();
+		cluster.triangleCount++;
+		cluster.centroidSum += centroid * area;
+		cluster.normalSum += normal;
+		cluster.area += area;
+
+		meshCentroidSum += centroid * area;
+		meshArea += area;
+	}
+
+	if (clusters.size() < 2 || meshArea <= 0.f) {
+		return;
+	}
+
+	glm::vec3 meshCentroid = meshCentroidSum / meshArea;
+
+	//clusters far out from the middle and facing away from it are the likeliest occluders (Sander et al.)
+	for (Cluster& cluster : clusters) {
+		float normalLength = glm::length(cluster.normalSum);
+		if (cluster.area <= 0.f || normalLength <= 0.f) {
+			continue;
+		}
+
+		glm::vec3 centroid = cluster.centroidSum / cluster.area;
+		cluster.sortKey = glm::dot(centroid - meshCentroid, cluster.normalSum / normalLength);
+	}
+
+	std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) {
+		return a.sortKey > b.sortKey;
+		});
+
+	std::vector<uint32_t> result;
+	result.reserve(indices.size());
+	for (const Cluster& cluster : clusters) {
+		auto first = indices.begin() + (size_t)cluster.firstTriangle * 3;
+		result.insert(result.end(), first, first + (size_t)cluster.triangleCount * 3);
+	}
+
+	indices.swap(result);
+}
+
+
+void meshopt::optimize_vertex_fetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+	std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+
+	std::vector<Vertex> reordered;
+	reordered.reserve(vertices.size());
+
+	for (uint32_t& index : indices) {
+		if (remap[index] == UINT32_MAX) {
+			remap[index] = (uint32_t)reordered.size();
+			reordered.push_back(vertices[index]);
+		}
+		index = remap[index];
+	}
+
+	vertices.swap(reordered);
+}
+
+
+void meshopt::optimize_mesh(Mesh& mesh, const char* name)
+{
+	//nothing to reorder, and the stats would divide by zero
+	if (mesh._vertices.empty() || mesh._indices.empty()) {
+		return;
+	}
+
+	VertexCacheStats before = analyze_vertex_cache(mesh._indices, mesh._vertices.size());
+
+	optimize_vertex_cache(mesh._indices, mesh._vertices.size());
+	optimize_overdraw(mesh._indices, mesh._vertices);
+	optimize_vertex_fetch(mesh._vertices, mesh._indices);
+
+	VertexCacheStats after = analyze_vertex_cache(mesh._indices, mesh._vertices.size());
+
+	//unused vertices may have been dropped
+	mesh.compute_bounds();
+
+	std::cout << "Optimized " << name << ": ACMR " << before.acmr << " -> " << after.acmr
+		<< ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vk_mesh.h>
+#include <vector>
+
+
+//load time passes that reorder mesh data so the GPU does less work drawing it.
+//They are meant to run once after Mesh::load_from_obj, in the order optimize_mesh() uses
+namespace meshopt {
+
+	//result of running an index buffer through a simulated FIFO post-transform cache
+	struct VertexCacheStats {
+		uint32_t verticesTransformed;
+		//average cache miss ratio, vertices transformed per triangle. 3 is the worst, around 0.5-0.7 is the best real meshes get
+		float acmr;
+		//average transform to vertex ratio, vertices transformed per unique vertex. 1 is ideal
+		float atvr;
+	};
+
+	VertexCacheStats analyze_vertex_cache(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize = 16);
+
+	//reorders triangles so vertices are reused while they are still in the post-transform cache (Tom Forsyth's linear-speed algorithm)
+	void optimize_vertex_cache(std::vector<uint32_t>& indices, size_t vertexCount);
+
+	//reorders clusters of triangles so the ones facing outwards, which are likely to hide the rest, are drawn first.
+	//Clusters start where the cache is cold anyway, so this keeps the ACMR of optimize_vertex_cache
+	void optimize_overdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, uint32_t cacheSize = 16);
+
+	//orders vertices by first use in the index buffer and drops the unused ones
+	void optimize_vertex_fetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+	//runs all the passes on the mesh and prints the cache stats before and after
+	void optimize_mesh(Mesh& mesh, const char* name);
+}
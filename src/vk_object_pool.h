@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+//names an object of an ObjectPool<T>. The generation tells a handle to a destroyed object apart from one to
+//whatever reused its slot, so stale handles are detected instead of silently pointing at something else
+template<typename T>
+struct Handle {
+	uint32_t index{ UINT32_MAX };
+	uint32_t generation{ 0 };
+
+	//only says the handle was filled in, ObjectPool::is_alive() says whether its object still exists
+	bool is_set() const { return index != UINT32_MAX; }
+
+	bool operator==(const Handle& other) const { return index == other.index && generation == other.generation; }
+	bool operator!=(const Handle& other) const { return !(*this == other); }
+};
+
+//objects in fixed size chunks that never move, so pointers stay valid until the object is destroyed.
+//Create and destroy are O(1), freed slots are reused most recent first, and the live objects are also listed
+//densely so systems can walk all of them, or split them into ranges for parallel_for, without skipping holes
+template<typename T, uint32_t ChunkSize = 1024>
+class ObjectPool {
+public:
+	ObjectPool() = default;
+	ObjectPool(const ObjectPool&) = delete;
+	ObjectPool& operator=(const ObjectPool&) = delete;
+
+	~ObjectPool() { clear(); }
+
+	template<typename... Args>
+	Handle<T> create(Args&&... args)
+	{
+		uint32_t index;
+		if (!_freeSlots.empty()) {
+			index = _freeSlots.back();
+			_freeSlots.pop_back();
+		}
+		else {
+			index = (uint32_t)_slots.size();
+			if (index % ChunkSize == 0) {
+				_chunks.push_back(std::make_unique<Chunk>());
+			}
+			_slots.emplace_back();
+		}
+
+		new (object_at(index)) T(std::forward<Args>(args)...);
+
+		Slot& slot = _slots[index];
+		slot.denseIndex = (uint32_t)_dense.size();
+		_dense.push_back(index);
+
+		return Handle<T>{ index, slot.generation };
+	}
+
+	//returns false for handles that were already destroyed
+	bool destroy(Handle<T> handle)
+	{
+		if (!is_alive(handle)) {
+			return false;
+		}
+
+		object_at(handle.index)->~T();
+
+		//the last dense entry takes the freed place
+		Slot& slot = _slots[handle.index];
+		uint32_t moved = _dense.back();
+		_dense[slot.denseIndex] = moved;
+		_slots[moved].denseIndex = slot.denseIndex;
+		_dense.pop_back();
+
+		//handles to the old object stop matching
+		slot.generation++;
+		slot.denseIndex = UINT32_MAX;
+		_freeSlots.push_back(handle.index);
+		return true;
+	}
+
+	bool is_alive(Handle<T> handle) const
+	{
+		return handle.index < _slots.size() && _slots[handle.index].generation == handle.generation
+			&& _slots[handle.index].denseIndex != UINT32_MAX;
+	}
+
+	//nullptr if the object was destroyed
+	T* get(Handle<T> handle) { return is_alive(handle) ? object_at(handle.index) : nullptr; }
+	const T* get(Handle<T> handle) const { return is_alive(handle) ? object_at(handle.index) : nullptr; }
+
+	//live objects
+	uint32_t size() const { return (uint32_t)_dense.size(); }
+
+	//the live objects in [0, size()). Destroying an object moves the last one into its place
+	T& at(uint32_t denseIndex) { return *object_at(_dense[denseIndex]); }
+	const T& at(uint32_t denseIndex) const { return *object_at(_dense[denseIndex]); }
+	Handle<T> handle_at(uint32_t denseIndex) const { return Handle<T>{ _dense[denseIndex], _slots[_dense[denseIndex]].generation }; }
+
+	//fn(Handle<T>, T&) for every live object. Objects must not be created or destroyed from inside it
+	template<typename F>
+	void for_each(F&& fn)
+	{
+		for (uint32_t i = 0; i < size(); i++) {
+			fn(handle_at(i), at(i));
+		}
+	}
+
+	//destroys every object. Outstanding handles all become stale, the chunks are kept
+	void clear()
+	{
+		while (!_dense.empty()) {
+			destroy(handle_at(size() - 1));
+		}
+	}
+
+private:
+	struct Chunk {
+		alignas(T) unsigned char storage[sizeof(T) * ChunkSize];
+	};
+
+	struct Slot {
+		uint32_t generation{ 1 };
+		//where the slot is in _dense, UINT32_MAX while free
+		uint32_t denseIndex{ UINT32_MAX };
+	};
+
+	T* object_at(uint32_t index) const
+	{
+		return reinterpret_cast<T*>(_chunks[index / ChunkSize]->storage) + index % ChunkSize;
+	}
+
+	std::vector<std::unique_ptr<Chunk>> _chunks;
+	std::vector<Slot> _slots;
+	std::vector<uint32_t> _freeSlots;
+	std::vector<uint32_t> _dense;
+};
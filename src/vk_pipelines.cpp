@@ -0,0 +1,375 @@
+#include "vk_pipelines.h"
+#include "vk_trace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+
+namespace {
+
+	//appends fields one word each, so padding and unused struct members never reach the description
+	class DescriptionWriter {
+	public:
+		explicit DescriptionWriter(std::vector<uint64_t>& words) : _words(words) {}
+
+		void add(uint64_t value) { _words.push_back(value); }
+
+		void add_float(float value)
+		{
+			uint32_t bits;
+			memcpy(&bits, &value, sizeof(bits));
+			add(bits);
+		}
+
+		//non-dispatchable handles are pointers or uint64_t depending on the platform
+		template<typename T>
+		void add_handle(T handle)
+		{
+			uint64_t bits = 0;
+			memcpy(&bits, &handle, sizeof(handle));
+			add(bits);
+		}
+
+		void add_string(const char* string)
+		{
+			size_t length = string ? strlen(string) : 0;
+			add(length);
+			for (size_t i = 0; i < length; i += sizeof(uint64_t)) {
+				uint64_t bits = 0;
+				memcpy(&bits, string + i, std::min(sizeof(uint64_t), length - i));
+				add(bits);
+			}
+		}
+
+	private:
+		std::vector<uint64_t>& _words;
+	};
+
+	//64-bit FNV-1a over the words
+	size_t hash_words(const std::vector<uint64_t>& words)
+	{
+		uint64_t hash = 14695981039346656037ull;
+		for (uint64_t word : words) {
+			for (int i = 0; i < 8; i++) {
+				hash ^= (word >> (i * 8)) & 0xFF;
+				hash *= 1099511628211ull;
+			}
+		}
+		return (size_t)hash;
+	}
+
+	void add_stencil_op(DescriptionWriter& writer, const VkStencilOpState& op)
+	{
+		writer.add(op.failOp);
+		writer.add(op.passOp);
+		writer.add(op.depthFailOp);
+		writer.add(op.compareOp);
+		writer.add(op.compareMask);
+		writer.add(op.writeMask);
+		writer.add(op.reference);
+	}
+}
+
+
+void PipelineBuilder::set_vertex_description(const VertexInputDescription& description)
+{
+	_vertexDescription = description;
+	_vertexInputInfo.flags = description.flags;
+}
+
+void PipelineBuilder::set_specialization_constant(uint32_t constantId, uint32_t value)
+{
+	VkSpecializationMapEntry entry = {};
+	entry.constantID = constantId;
+	entry.offset = (uint32_t)(_specializationData.size() * sizeof(uint32_t));
+	entry.size = sizeof(uint32_t);
+
+	_specializationEntries.push_back(entry);
+	_specializationData.push_back(value);
+}
+
+void PipelineBuilder::clear_specialization_constants()
+{
+	_specializationEntries.clear();
+	_specializationData.clear();
+}
+
+VkPipeline PipelineBuilder::build_pipeline(VkDevice device, VkRenderPass pass, VkPipelineCache cache) const {
+	VK_TRACE_ZONE("build_pipeline");
+
+	//one viewport and scissor, both set when recording. A window resize doesn't need new pipelines that way
+	VkPipelineViewportStateCreateInfo viewportState = {};
+	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportState.pNext = nullptr;
+
+	viewportState.viewportCount = 1;
+	viewportState.pViewports = nullptr;
+	viewportState.scissorCount = 1;
+	viewportState.pScissors = nullptr;
+
+	VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+	VkPipelineDynamicStateCreateInfo dynamicState = {};
+	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicState.pNext = nullptr;
+
+	dynamicState.dynamicStateCount = 2;
+	dynamicState.pDynamicStates = dynamicStates;
+
+	//setup dummy color blending. We aren't using transparent objects yet
+	//the blending is just "no blend", but we do write to the color attachment
+	VkPipelineColorBlendStateCreateInfo colorBlending = {};
+	colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	colorBlending.pNext = nullptr;
+
+	colorBlending.logicOpEnable = VK_FALSE;
+	colorBlending.logicOp = VK_LOGIC_OP_COPY;
+	colorBlending.attachmentCount = 1;
+	colorBlending.pAttachments = &_colorBlendAttachment;
+
+	//connect the vertex input info to the layout this builder owns
+	VkPipelineVertexInputStateCreateInfo vertexInputInfo = _vertexInputInfo;
+	vertexInputInfo.pVertexAttributeDescriptions = _vertexDescription.attributes.data();
+	vertexInputInfo.vertexAttributeDescriptionCount = (uint32_t)_vertexDescription.attributes.size();
+
+	vertexInputInfo.pVertexBindingDescriptions = _vertexDescription.bindings.data();
+	vertexInputInfo.vertexBindingDescriptionCount = (uint32_t)_vertexDescription.bindings.size();
+
+	VkSpecializationInfo specialization = {};
+	specialization.mapEntryCount = (uint32_t)_specializationEntries.size();
+	specialization.pMapEntries = _specializationEntries.data();
+	specialization.dataSize = _specializationData.size() * sizeof(uint32_t);
+	specialization.pData = _specializationData.data();
+
+	std::vector<VkPipelineShaderStageCreateInfo> shaderStages = _shaderStages;
+	if (!_specializationEntries.empty()) {
+		for (VkPipelineShaderStageCreateInfo& stage : shaderStages) {
+			stage.pSpecializationInfo = &specialization;
+		}
+	}
+
+	VkGraphicsPipelineCreateInfo pipelineInfo = {};
+
+	//build the actual pipeline
+	//we now use all of the info structs we have been writing into into this one to create the pipeline
+	//VkGraphicsPipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineInfo.pNext = nullptr;
+
+	pipelineInfo.stageCount = shaderStages.size();
+	pipelineInfo.pStages = shaderStages.data();
+	pipelineInfo.pVertexInputState = &vertexInputInfo;
+	pipelineInfo.pInputAssemblyState = &_inputAssembly;
+	pipelineInfo.pViewportState = &viewportState;
+	pipelineInfo.pRasterizationState = &_rasterizer;
+	pipelineInfo.pMultisampleState = &_multisampling;
+	pipelineInfo.pColorBlendState = &colorBlending;
+	pipelineInfo.layout = _pipelineLayout;
+	pipelineInfo.renderPass = pass;
+	pipelineInfo.subpass = 0;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineInfo.pDepthStencilState = &_depthStencil;
+	pipelineInfo.pDynamicState = &dynamicState;
+
+	//it's easy to error out on create graphics pipeline, so we handle it a bit better than the common VK_CHECK case
+	VkPipeline newPipeline;
+	if (vkCreateGraphicsPipelines(
+		device, cache, 1, &pipelineInfo, nullptr, &newPipeline) != VK_SUCCESS) {
+		std::cout << "failed to create pipeline\n";
+		return VK_NULL_HANDLE; // failed to create graphics pipeline
+	}
+	else
+	{
+		return newPipeline;
+	}
+
+}
+
+
+void PipelineCompiler::init(VkDevice device, VkPipelineCache cache, JobSystem* jobSystem)
+{
+	_device = device;
+	_cache = cache;
+	_jobSystem = jobSystem;
+}
+
+AsyncPipeline* PipelineCompiler::compile(const PipelineBuilder& builder, VkRenderPass pass)
+{
+	_pipelines.push_back(std::make_unique<AsyncPipeline>());
+	AsyncPipeline* result = _pipelines.back().get();
+
+	//pipeline caches are synchronized internally, so every job can go through the same one
+	VkDevice device = _device;
+	VkPipelineCache cache = _cache;
+	_jobSystem->run([builder, pass, device, cache, result]() {
+		result->pipeline.store(builder.build_pipeline(device, pass, cache), std::memory_order_relaxed);
+		result->done.store(true, std::memory_order_release);
+		}, &_counter);
+
+	return result;
+}
+
+AsyncPipeline* PipelineCompiler::build(const PipelineBuilder& builder, VkRenderPass pass)
+{
+	_pipelines.push_back(std::make_unique<AsyncPipeline>());
+	AsyncPipeline* result = _pipelines.back().get();
+
+	result->pipeline.store(builder.build_pipeline(_device, pass, _cache), std::memory_order_relaxed);
+	result->done.store(true, std::memory_order_release);
+	return result;
+}
+
+void PipelineCompiler::wait_all()
+{
+	_jobSystem->wait(&_counter);
+}
+
+void PipelineCompiler::destroy()
+{
+	wait_all();
+
+	for (std::unique_ptr<AsyncPipeline>& pipeline : _pipelines) {
+		if (pipeline->pipeline != VK_NULL_HANDLE) {
+			vkDestroyPipeline(_device, pipeline->pipeline, nullptr);
+		}
+	}
+	_pipelines.clear();
+}
+
+
+PipelineDescription PipelineDescription::describe(const PipelineBuilder& builder, VkRenderPass pass)
+{
+	PipelineDescription description;
+	DescriptionWriter writer(description.words);
+
+	writer.add(builder._shaderStages.size());
+	for (const VkPipelineShaderStageCreateInfo& stage : builder._shaderStages) {
+		writer.add(stage.stage);
+		writer.add_handle(stage.module);
+		writer.add_string(stage.pName);
+	}
+
+	writer.add(builder._specializationEntries.size());
+	for (const VkSpecializationMapEntry& entry : builder._specializationEntries) {
+		writer.add(entry.constantID);
+		writer.add(entry.offset);
+		writer.add(entry.size);
+	}
+	for (uint32_t value : builder._specializationData) {
+		writer.add(value);
+	}
+
+	writer.add(builder._vertexDescription.flags);
+	writer.add(builder._vertexDescription.bindings.size());
+	for (const VkVertexInputBindingDescription& binding : builder._vertexDescription.bindings) {
+		writer.add(binding.binding);
+		writer.add(binding.stride);
+		writer.add(binding.inputRate);
+	}
+	writer.add(builder._vertexDescription.attributes.size());
+	for (const VkVertexInputAttributeDescription& attribute : builder._vertexDescription.attributes) {
+		writer.add(attribute.location);
+		writer.add(attribute.binding);
+		writer.add(attribute.format);
+		writer.add(attribute.offset);
+	}
+
+	writer.add(builder._inputAssembly.topology);
+	writer.add(builder._inputAssembly.primitiveRestartEnable);
+
+	const VkPipelineRasterizationStateCreateInfo& rasterizer = builder._rasterizer;
+	writer.add(rasterizer.depthClampEnable);
+	writer.add(rasterizer.rasterizerDiscardEnable);
+	writer.add(rasterizer.polygonMode);
+	writer.add(rasterizer.cullMode);
+	writer.add(rasterizer.frontFace);
+	writer.add(rasterizer.depthBiasEnable);
+	writer.add_float(rasterizer.depthBiasConstantFactor);
+	writer.add_float(rasterizer.depthBiasClamp);
+	writer.add_float(rasterizer.depthBiasSlopeFactor);
+	writer.add_float(rasterizer.lineWidth);
+
+	const VkPipelineColorBlendAttachmentState& blend = builder._colorBlendAttachment;
+	writer.add(blend.blendEnable);
+	writer.add(blend.srcColorBlendFactor);
+	writer.add(blend.dstColorBlendFactor);
+	writer.add(blend.colorBlendOp);
+	writer.add(blend.srcAlphaBlendFactor);
+	writer.add(blend.dstAlphaBlendFactor);
+	writer.add(blend.alphaBlendOp);
+	writer.add(blend.colorWriteMask);
+
+	const VkPipelineMultisampleStateCreateInfo& multisampling = builder._multisampling;
+	writer.add(multisampling.rasterizationSamples);
+	writer.add(multisampling.sampleShadingEnable);
+	writer.add_float(multisampling.minSampleShading);
+	writer.add(multisampling.alphaToCoverageEnable);
+	writer.add(multisampling.alphaToOneEnable);
+
+	const VkPipelineDepthStencilStateCreateInfo& depthStencil = builder._depthStencil;
+	writer.add(depthStencil.depthTestEnable);
+	writer.add(depthStencil.depthWriteEnable);
+	writer.add(depthStencil.depthCompareOp);
+	writer.add(depthStencil.depthBoundsTestEnable);
+	writer.add_float(depthStencil.minDepthBounds);
+	writer.add_float(depthStencil.maxDepthBounds);
+	writer.add(depthStencil.stencilTestEnable);
+	//the stencil ops are ignored while the test is off, so they don't make pipelines different then
+	if (depthStencil.stencilTestEnable) {
+		add_stencil_op(writer, depthStencil.front);
+		add_stencil_op(writer, depthStencil.back);
+	}
+
+	writer.add_handle(builder._pipelineLayout);
+	writer.add_handle(pass);
+
+	description.hash = hash_words(description.words);
+	return description;
+}
+
+
+void PipelineStateCache::init(PipelineCompiler* compiler)
+{
+	_compiler = compiler;
+}
+
+VkPipeline PipelineStateCache::get_pipeline(const PipelineBuilder& builder, VkRenderPass pass)
+{
+	PipelineDescription description = PipelineDescription::describe(builder, pass);
+
+	auto it = _pipelines.find(description);
+	if (it != _pipelines.end()) {
+		_stats.hits++;
+		if (!it->second->is_ready()) {
+			_compiler->wait_all();
+		}
+		return it->second->pipeline.load(std::memory_order_relaxed);
+	}
+
+	_stats.misses++;
+	AsyncPipeline* pipeline = _compiler->build(builder, pass);
+	_pipelines.emplace(std::move(description), pipeline);
+	return pipeline->pipeline.load(std::memory_order_relaxed);
+}
+
+AsyncPipeline* PipelineStateCache::get_pipeline_async(const PipelineBuilder& builder, VkRenderPass pass)
+{
+	PipelineDescription description = PipelineDescription::describe(builder, pass);
+
+	auto it = _pipelines.find(description);
+	if (it != _pipelines.end()) {
+		_stats.hits++;
+		return it->second;
+	}
+
+	_stats.misses++;
+	AsyncPipeline* pipeline = _compiler->compile(builder, pass);
+	_pipelines.emplace(std::move(description), pipeline);
+	return pipeline;
+}
+
+void PipelineStateCache::clear()
+{
+	_pipelines.clear();
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <vk_types.h>
+#include <vk_mesh.h>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "vk_jobs.h"
+
+
+class PipelineBuilder {
+public:
+
+	std::vector<VkPipelineShaderStageCreateInfo> _shaderStages;
+	VkPipelineVertexInputStateCreateInfo _vertexInputInfo;
+	VkPipelineInputAssemblyStateCreateInfo _inputAssembly;
+	VkPipelineRasterizationStateCreateInfo _rasterizer;
+	VkPipelineColorBlendAttachmentState _colorBlendAttachment;
+	VkPipelineMultisampleStateCreateInfo _multisampling;
+	VkPipelineLayout _pipelineLayout;
+	VkPipelineDepthStencilStateCreateInfo _depthStencil;
+
+	//the builder owns its vertex layout and specialization constants, so a copy of it can be built on another thread.
+	//build_pipeline() points the create infos at them
+	VertexInputDescription _vertexDescription;
+	std::vector<VkSpecializationMapEntry> _specializationEntries;
+	std::vector<uint32_t> _specializationData;
+
+	void set_vertex_description(const VertexInputDescription& description);
+
+	//applied to every shader stage. Stages without a constant of that id ignore it
+	void set_specialization_constant(uint32_t constantId, uint32_t value);
+	void clear_specialization_constants();
+
+	//viewport and scissor are always dynamic state, so the pipeline works at any window size.
+	//They have to be set in every command buffer that draws with it
+	VkPipeline build_pipeline(VkDevice device, VkRenderPass pass, VkPipelineCache cache = VK_NULL_HANDLE) const;
+};
+
+//a pipeline that is being compiled on a job thread. pipeline stays VK_NULL_HANDLE until done is set,
+//and after that too if compilation failed
+struct AsyncPipeline {
+	std::atomic<VkPipeline> pipeline{ VK_NULL_HANDLE };
+	std::atomic<bool> done{ false };
+
+	bool is_ready() const { return done.load(std::memory_order_acquire); }
+};
+
+//builds pipelines on the job system so new materials don't stall the frame that needs them
+class PipelineCompiler {
+public:
+	void init(VkDevice device, VkPipelineCache cache, JobSystem* jobSystem);
+
+	//copies the builder and queues its compilation. The returned pipeline is owned by the compiler until destroy()
+	AsyncPipeline* compile(const PipelineBuilder& builder, VkRenderPass pass);
+
+	//builds the pipeline on this thread. The result is already done, and owned by the compiler like the queued ones
+	AsyncPipeline* build(const PipelineBuilder& builder, VkRenderPass pass);
+
+	//blocks until every queued compilation has finished. The calling thread helps with them
+	void wait_all();
+
+	//waits for outstanding compilations, then destroys every pipeline created through the compiler
+	void destroy();
+
+private:
+	VkDevice _device{ VK_NULL_HANDLE };
+	VkPipelineCache _cache{ VK_NULL_HANDLE };
+	JobSystem* _jobSystem{ nullptr };
+	JobCounter _counter;
+
+	std::vector<std::unique_ptr<AsyncPipeline>> _pipelines;
+};
+
+//everything in a PipelineBuilder that ends up in the pipeline, plus the render pass, flattened into words.
+//Viewport and scissor are dynamic so they are not part of it. pNext chains are not followed, the builder doesn't use any
+struct PipelineDescription {
+	std::vector<uint64_t> words;
+	size_t hash{ 0 };
+
+	static PipelineDescription describe(const PipelineBuilder& builder, VkRenderPass pass);
+
+	bool operator==(const PipelineDescription& other) const { return hash == other.hash && words == other.words; }
+};
+
+struct PipelineDescriptionHash {
+	size_t operator()(const PipelineDescription& description) const { return description.hash; }
+};
+
+struct PipelineStateStats {
+	uint32_t hits{ 0 };
+	uint32_t misses{ 0 };
+};
+
+//hands out one pipeline per distinct builder state, so materials that describe the same pipeline share it.
+//Pipelines are created through the compiler, which also owns them. Only used from the main thread
+class PipelineStateCache {
+public:
+	void init(PipelineCompiler* compiler);
+
+	//returns the pipeline of an equal description, or builds it now. A hit on a pipeline that is still
+	//compiling in the background waits for the compiler
+	VkPipeline get_pipeline(const PipelineBuilder& builder, VkRenderPass pass);
+
+	//same, but a miss is queued on the compiler instead of built on this thread
+	AsyncPipeline* get_pipeline_async(const PipelineBuilder& builder, VkRenderPass pass);
+
+	PipelineStateStats stats() const { return _stats; }
+
+	size_t size() const { return _pipelines.size(); }
+
+	//forgets every entry. The pipelines themselves go with the compiler
+	void clear();
+
+private:
+	PipelineCompiler* _compiler{ nullptr };
+	PipelineStateStats _stats;
+
+	std::unordered_map<PipelineDescription, AsyncPipeline*, PipelineDescriptionHash> _pipelines;
+};
@@ -0,0 +1,161 @@
+#include "vk_profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+
+
+void GpuProfiler::init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t framesInFlight)
+{
+	_device = device;
+	_framesInFlight = framesInFlight;
+
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> families(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+
+	//some software implementations have no timestamps
+	uint32_t validBits = families[queueFamily].timestampValidBits;
+	if (validBits == 0) {
+		std::cout << "GPU profiler: queue family " << queueFamily << " has no timestamps, GPU timings are unavailable" << std::endl;
+		return;
+	}
+	_timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	_timestampPeriod = properties.limits.timestampPeriod;
+
+	VkQueryPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	poolInfo.pNext = nullptr;
+	poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	poolInfo.queryCount = framesInFlight * MAX_GPU_SCOPES * 2;
+
+	VK_CHECK(vkCreateQueryPool(_device, &poolInfo, nullptr, &_queryPool));
+
+	_recorded.resize(framesInFlight);
+}
+
+void GpuProfiler::destroy()
+{
+	if (_queryPool != VK_NULL_HANDLE) {
+		vkDestroyQueryPool(_device, _queryPool, nullptr);
+		_queryPool = VK_NULL_HANDLE;
+	}
+}
+
+void GpuProfiler::begin_frame(VkCommandBuffer cmd, uint32_t frameSlot)
+{
+	if (!is_supported()) {
+		return;
+	}
+
+	_currentSlot = frameSlot;
+	read_back(frameSlot);
+
+	vkCmdResetQueryPool(cmd, _queryPool, frameSlot * MAX_GPU_SCOPES * 2, MAX_GPU_SCOPES * 2);
+}
+
+uint32_t GpuProfiler::begin_scope(VkCommandBuffer cmd, const char* name, VkPipelineStageFlagBits stage)
+{
+	if (!is_supported() || _recorded[_currentSlot].size() >= MAX_GPU_SCOPES) {
+		return UINT32_MAX;
+	}
+	std::vector<RecordedScope>& recorded = _recorded[_currentSlot];
+
+	auto it = _scopeIndices.find(name);
+	if (it == _scopeIndices.end()) {
+		it = _scopeIndices.emplace(name, (uint32_t)_scopes.size()).first;
+		_scopes.emplace_back();
+		_scopes.back().name = name;
+	}
+
+	RecordedScope scope;
+	scope.statsIndex = it->second;
+	scope.firstQuery = (_currentSlot * MAX_GPU_SCOPES + (uint32_t)recorded.size()) * 2;
+	scope.ended = false;
+
+	vkCmdWriteTimestamp(cmd, stage, _queryPool, scope.firstQuery);
+
+	recorded.push_back(scope);
+	return (uint32_t)recorded.size() - 1;
+}
+
+void GpuProfiler::end_scope(VkCommandBuffer cmd, uint32_t scope, VkPipelineStageFlagBits stage)
+{
+	if (!is_supported() || scope == UINT32_MAX) {
+		return;
+	}
+
+	RecordedScope& recorded = _recorded[_currentSlot][scope];
+	vkCmdWriteTimestamp(cmd, stage, _queryPool, recorded.firstQuery + 1);
+	recorded.ended = true;
+}
+
+void GpuProfiler::read_back(uint32_t frameSlot)
+{
+	std::vector<RecordedScope>& recorded = _recorded[frameSlot];
+	if (recorded.empty()) {
+		return;
+	}
+
+	//the slot's fence has signalled, so every query its frame wrote is available and this doesn't wait. A frame that
+	//returned early, or a scope that was never ended, leaves queries unwritten. With availability those only cost
+	//their own scope instead of failing the whole read with VK_NOT_READY. Each query is a value and an availability
+	uint64_t results[MAX_GPU_SCOPES * 2][2];
+	uint32_t queryCount = (uint32_t)recorded.size() * 2;
+	VkResult result = vkGetQueryPoolResults(_device, _queryPool, frameSlot * MAX_GPU_SCOPES * 2, queryCount,
+		sizeof(results), results, sizeof(results[0]), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+	if (result == VK_SUCCESS || result == VK_NOT_READY) {
+		uint32_t base = frameSlot * MAX_GPU_SCOPES * 2;
+		for (const RecordedScope& scope : recorded) {
+			uint32_t first = scope.firstQuery - base;
+			if (!scope.ended || results[first][1] == 0 || results[first + 1][1] == 0) {
+				continue;
+			}
+
+			uint64_t ticks = (results[first + 1][0] - results[first][0]) & _timestampMask;
+			float ms = (float)((double)ticks * _timestampPeriod / 1000000.0);
+
+			GpuScopeStats& stats = _scopes[scope.statsIndex];
+			stats.lastMs = ms;
+			stats.samples[stats.nextSample] = ms;
+			stats.nextSample = (stats.nextSample + 1) % GPU_PROFILER_WINDOW;
+			stats.sampleCount = std::min(stats.sampleCount + 1, GPU_PROFILER_WINDOW);
+
+			float sum = 0.f;
+			for (uint32_t i = 0; i < stats.sampleCount; i++) {
+				sum += stats.samples[i];
+			}
+			stats.averageMs = sum / stats.sampleCount;
+		}
+	}
+
+	recorded.clear();
+}
+
+const GpuScopeStats* GpuProfiler::find_scope(const char* name) const
+{
+	auto it = _scopeIndices.find(name);
+	if (it == _scopeIndices.end() || _scopes[it->second].sampleCount == 0) {
+		return nullptr;
+	}
+	return &_scopes[it->second];
+}
+
+std::string GpuProfiler::summary() const
+{
+	std::string line = "GPU:";
+	for (const GpuScopeStats& scope : _scopes) {
+		if (scope.sampleCount == 0) {
+			continue;
+		}
+
+		char entry[128];
+		snprintf(entry, sizeof(entry), " %s %.3f ms", scope.name.c_str(), scope.averageMs);
+		line += entry;
+	}
+	return line;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <vk_types.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//timestamp scopes one frame can record. Scopes past this are dropped
+constexpr uint32_t MAX_GPU_SCOPES = 32;
+//frames the rolling averages cover
+constexpr uint32_t GPU_PROFILER_WINDOW = 64;
+
+//rolling timings of one named scope
+struct GpuScopeStats {
+	std::string name;
+	float lastMs{ 0.f };
+	float averageMs{ 0.f };
+
+	//last GPU_PROFILER_WINDOW samples, oldest overwritten first
+	float samples[GPU_PROFILER_WINDOW]{};
+	uint32_t sampleCount{ 0 };
+	uint32_t nextSample{ 0 };
+};
+
+//GPU timings from timestamp queries. Every frame slot has its own queries, and they are read back when the slot
+//comes around again, after its fence was waited on, so reading never stalls.
+//Scopes are recorded into primary command buffers from the main thread only
+class GpuProfiler {
+public:
+	void init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t framesInFlight);
+
+	void destroy();
+
+	//false if the queue family has no timestamps. All other calls do nothing then
+	bool is_supported() const { return _queryPool != VK_NULL_HANDLE; }
+
+	//reads back what the slot's previous frame recorded and resets its queries. Call after waiting on the slot's fence,
+	//outside of a render pass
+	void begin_frame(VkCommandBuffer cmd, uint32_t frameSlot);
+
+	//scopes with the same name are the same scope. Returns the id for end_scope()
+	uint32_t begin_scope(VkCommandBuffer cmd, const char* name, VkPipelineStageFlagBits stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+
+	void end_scope(VkCommandBuffer cmd, uint32_t scope, VkPipelineStageFlagBits stage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
+	//every scope seen so far, in order of first use
+	const std::vector<GpuScopeStats>& scopes() const { return _scopes; }
+
+	//nullptr if the scope was never recorded or not read back yet
+	const GpuScopeStats* find_scope(const char* name) const;
+
+	//one line with the rolling average of every scope
+	std::string summary() const;
+
+private:
+	//a scope written into a frame slot, waiting to be read back
+	struct RecordedScope {
+		uint32_t statsIndex;
+		uint32_t firstQuery;
+		bool ended;
+	};
+
+	void read_back(uint32_t frameSlot);
+
+	VkDevice _device{ VK_NULL_HANDLE };
+	VkQueryPool _queryPool{ VK_NULL_HANDLE };
+	//nanoseconds per tick
+	float _timestampPeriod{ 0.f };
+	uint64_t _timestampMask{ 0 };
+	uint32_t _framesInFlight{ 0 };
+
+	uint32_t _currentSlot{ 0 };
+	//per frame slot
+	std::vector<std::vector<RecordedScope>> _recorded;
+
+	std::vector<GpuScopeStats> _scopes;
+	std::unordered_map<std::string, uint32_t> _scopeIndices;
+};
@@ -0,0 +1,184 @@
+#include "vk_render_systems.h"
+#include "vk_jobs.h"
+#include "vk_trace.h"
+
+#include <cstring>
+#include <limits>
+
+//the packed bounds are handed to cull_spheres() as they are
+static_assert(sizeof(BoundsComponent) == sizeof(glm::vec4), "BoundsComponent must be a bare sphere");
+
+
+//runs fn(begin, end) over [0, count), as jobs if there is enough work
+template<typename F>
+static void for_each_range(JobSystem& jobSystem, uint32_t count, const F& fn)
+{
+	if (count <= rendersys::GROUP_SIZE) {
+		fn(0, count);
+		return;
+	}
+
+	JobCounter counter;
+	jobSystem.parallel_for(count, rendersys::GROUP_SIZE, fn, &counter);
+	jobSystem.wait(&counter);
+}
+
+void rendersys::sync_transforms(Registry& registry, const TransformHierarchy& transforms, JobSystem& jobSystem)
+{
+	VK_TRACE_ZONE("sync_transforms");
+
+	TransformComponent* components = registry.pool<TransformComponent>().data();
+	for_each_range(jobSystem, registry.pool<TransformComponent>().size(), [&](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; i++) {
+			if (components[i].node != INVALID_TRANSFORM) {
+				components[i].world = transforms.get_world_matrix(components[i].node);
+			}
+		}
+		});
+}
+
+void rendersys::add_missing_bounds(Registry& registry)
+{
+	VK_TRACE_ZONE("add_missing_bounds");
+
+	const ComponentPool<BoundsComponent>& boundsPool = registry.pool<BoundsComponent>();
+	const ComponentPool<MeshComponent>& meshPool = registry.pool<MeshComponent>();
+
+	//collected first, adding while walking the mesh pool isn't allowed
+	std::vector<Entity> missing;
+	for (uint32_t i = 0; i < meshPool.size(); i++) {
+		if (!boundsPool.contains(meshPool.entities()[i])) {
+			missing.push_back(meshPool.entities()[i]);
+		}
+	}
+
+	for (Entity entity : missing) {
+		registry.add<BoundsComponent>(entity, { glm::vec4(0.f, 0.f, 0.f, std::numeric_limits<float>::infinity()) });
+	}
+}
+
+void rendersys::update_bounds(Registry& registry, JobSystem& jobSystem)
+{
+	VK_TRACE_ZONE("update_bounds");
+
+	//looked up before the jobs start, pool() may create a pool
+	ComponentPool<BoundsComponent>& boundsPool = registry.pool<BoundsComponent>();
+	const ComponentPool<TransformComponent>& transformPool = registry.pool<TransformComponent>();
+	const ComponentPool<MeshComponent>& meshPool = registry.pool<MeshComponent>();
+
+	for_each_range(jobSystem, boundsPool.size(), [&](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; i++) {
+			Entity entity = boundsPool.entities()[i];
+			const TransformComponent* transform = transformPool.get(entity);
+			const MeshComponent* mesh = meshPool.get(entity);
+			if (!transform || !mesh) {
+				continue;
+			}
+
+			const glm::mat4& world = transform->world;
+			const MeshBounds& bounds = mesh->mesh->_bounds;
+
+			float scale = glm::max(glm::length(glm::vec3(world[0])), glm::max(glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))));
+			glm::vec3 center = glm::vec3(world * glm::vec4(bounds.origin, 1.f));
+			boundsPool.data()[i].sphere = glm::vec4(center, bounds.radius * scale);
+		}
+		});
+}
+
+void rendersys::cull(Registry& registry, const Frustum& frustum, JobSystem& jobSystem, std::vector<uint32_t>& visible)
+{
+	VK_TRACE_ZONE("cull");
+
+	const ComponentPool<BoundsComponent>& boundsPool = registry.pool<BoundsComponent>();
+	const glm::vec4* spheres = reinterpret_cast<const glm::vec4*>(boundsPool.data());
+	uint32_t count = boundsPool.size();
+	if (count == 0) {
+		visible.clear();
+		return;
+	}
+
+	//every range packs its survivors at the start of its own part of visible, then the parts are moved together
+	uint32_t rangeCount = (count + GROUP_SIZE - 1) / GROUP_SIZE;
+	std::vector<uint32_t> rangeVisible(rangeCount, 0);
+	visible.resize(count);
+
+	for_each_range(jobSystem, count, [&](uint32_t begin, uint32_t end) {
+		rangeVisible[begin / GROUP_SIZE] = cull_spheres(frustum, spheres + begin, end - begin, begin, visible.data() + begin);
+		});
+
+	uint32_t visibleCount = 0;
+	for (uint32_t range = 0; range < rangeCount; range++) {
+		if (visibleCount != range * GROUP_SIZE) {
+			memmove(visible.data() + visibleCount, visible.data() + range * GROUP_SIZE, rangeVisible[range] * sizeof(uint32_t));
+		}
+		visibleCount += rangeVisible[range];
+	}
+	visible.resize(visibleCount);
+}
+
+void rendersys::collect_visible(Registry& registry, const std::vector<uint32_t>& visible, std::vector<RenderObject>& out)
+{
+	VK_TRACE_ZONE("collect_visible");
+
+	const ComponentPool<BoundsComponent>& boundsPool = registry.pool<BoundsComponent>();
+	const ComponentPool<MeshComponent>& meshPool = registry.pool<MeshComponent>();
+	const ComponentPool<MaterialComponent>& materialPool = registry.pool<MaterialComponent>();
+	const ComponentPool<TransformComponent>& transformPool = registry.pool<TransformComponent>();
+	const ComponentPool<VisibilityComponent>& visibilityPool = registry.pool<VisibilityComponent>();
+
+	out.reserve(out.size() + visible.size());
+	for (uint32_t index : visible) {
+		Entity entity = boundsPool.entities()[index];
+
+		const VisibilityComponent* visibility = visibilityPool.get(entity);
+		if (visibility && !visibility->visible) {
+			continue;
+		}
+
+		const MeshComponent* mesh = meshPool.get(entity);
+		const MaterialComponent* material = materialPool.get(entity);
+		const TransformComponent* transform = transformPool.get(entity);
+		if (!mesh || !material || !transform) {
+			continue;
+		}
+
+		RenderObject object;
+		object.mesh = mesh->mesh;
+		object.material = material->material;
+		object.transformMatrix = transform->world;
+		out.push_back(object);
+	}
+}
+
+void rendersys::collect_renderables(Registry& registry, bool visibleOnly, std::vector<RenderObject>& out)
+{
+	VK_TRACE_ZONE("collect_renderables");
+
+	const ComponentPool<MeshComponent>& meshPool = registry.pool<MeshComponent>();
+	const ComponentPool<MaterialComponent>& materialPool = registry.pool<MaterialComponent>();
+	const ComponentPool<TransformComponent>& transformPool = registry.pool<TransformComponent>();
+	const ComponentPool<VisibilityComponent>& visibilityPool = registry.pool<VisibilityComponent>();
+
+	for (uint32_t i = 0; i < meshPool.size(); i++) {
+		Entity entity = meshPool.entities()[i];
+
+		if (visibleOnly) {
+			const VisibilityComponent* visibility = visibilityPool.get(entity);
+			if (visibility && !visibility->visible) {
+				continue;
+			}
+		}
+
+		const MaterialComponent* material = materialPool.get(entity);
+		const TransformComponent* transform = transformPool.get(entity);
+		if (!material || !transform) {
+			continue;
+		}
+
+		RenderObject object;
+		object.mesh = meshPool.data()[i].mesh;
+		object.material = material->material;
+		object.transformMatrix = transform->world;
+		out.push_back(object);
+	}
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+#include "vk_ecs.h"
+#include "vk_gameobject.h"
+#include "vk_culling.h"
+
+class JobSystem;
+
+//passes over the render components. Each walks the packed array of one component type and only looks the others
+//up, so they split into independent ranges that run as jobs
+namespace rendersys {
+	//entities per job. Smaller pools are processed on the calling thread
+	constexpr uint32_t GROUP_SIZE = 2048;
+
+	//copies the world matrix of every entity that has a hierarchy node
+	void sync_transforms(Registry& registry, const TransformHierarchy& transforms, JobSystem& jobSystem);
+
+	//gives every entity with a mesh but no BoundsComponent one with an infinite radius, so cull() never drops it.
+	//update_bounds() then replaces it with the mesh's sphere if the entity has a transform. Adding components is a
+	//structural change, so this runs on the calling thread
+	void add_missing_bounds(Registry& registry);
+
+	//moves each mesh's bounding sphere to world space. The radius grows with the largest axis scale
+	void update_bounds(Registry& registry, JobSystem& jobSystem);
+
+	//tests every BoundsComponent against the frustum with cull_spheres(), and fills visible with the positions in the
+	//bounds pool of the ones at least partially inside, in pool order
+	void cull(Registry& registry, const Frustum& frustum, JobSystem& jobSystem, std::vector<uint32_t>& visible);
+
+	//appends a RenderObject for each bounds pool position in visible, as returned by cull(), skipping hidden entities
+	//and ones without a transform, mesh and material
+	void collect_visible(Registry& registry, const std::vector<uint32_t>& visible, std::vector<RenderObject>& out);
+
+	//appends a RenderObject for every entity with a transform, mesh and material, skipping hidden ones if visibleOnly
+	void collect_renderables(Registry& registry, bool visibleOnly, std::vector<RenderObject>& out);
+}
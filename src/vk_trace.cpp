@@ -0,0 +1,152 @@
+#include "vk_trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace {
+
+	//the fields are atomics only so the dump can read a ring while its thread writes to it
+	struct TraceSlot {
+		std::atomic<const char*> name{ nullptr };
+		std::atomic<uint64_t> startNs{ 0 };
+		std::atomic<uint64_t> durationNs{ 0 };
+	};
+
+	//written by its own thread only. _head counts every zone ever recorded, the ring holds the last TRACE_RING_CAPACITY
+	struct ThreadRing {
+		uint32_t threadId;
+		std::string name;
+		std::atomic<uint64_t> head{ 0 };
+		TraceSlot slots[TRACE_RING_CAPACITY];
+	};
+
+	//rings are never freed, threads that already exited still show up in the dump
+	std::mutex g_ringsLock;
+	std::vector<std::unique_ptr<ThreadRing>> g_rings;
+
+	thread_local ThreadRing* tl_ring = nullptr;
+
+	ThreadRing* thread_ring()
+	{
+		if (!tl_ring) {
+			std::lock_guard<std::mutex> lock(g_ringsLock);
+			g_rings.push_back(std::make_unique<ThreadRing>());
+			tl_ring = g_rings.back().get();
+			tl_ring->threadId = (uint32_t)g_rings.size() - 1;
+			tl_ring->name = "thread " + std::to_string(tl_ring->threadId);
+		}
+		return tl_ring;
+	}
+
+	struct DumpedZone {
+		const char* name;
+		uint64_t startNs;
+		uint64_t durationNs;
+	};
+
+	//copies the zones of a ring that weren't overwritten while copying
+	void copy_ring(const ThreadRing& ring, std::vector<DumpedZone>& zones)
+	{
+		zones.clear();
+
+		uint64_t head = ring.head.load(std::memory_order_acquire);
+		uint64_t first = head > TRACE_RING_CAPACITY ? head - TRACE_RING_CAPACITY : 0;
+		for (uint64_t i = first; i < head; i++) {
+			const TraceSlot& slot = ring.slots[i % TRACE_RING_CAPACITY];
+			zones.push_back({ slot.name.load(std::memory_order_relaxed), slot.startNs.load(std::memory_order_relaxed),
+				slot.durationNs.load(std::memory_order_relaxed) });
+		}
+
+		//the writer may have lapped us. It is at most writing zone newHead now, which reuses the slot of
+		//zone newHead - capacity, so everything before and including that one is unreliable
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint64_t newHead = ring.head.load(std::memory_order_relaxed);
+		if (newHead >= first + TRACE_RING_CAPACITY) {
+			uint64_t torn = std::min<uint64_t>(newHead - TRACE_RING_CAPACITY + 1 - first, zones.size());
+			zones.erase(zones.begin(), zones.begin() + torn);
+		}
+	}
+
+	void write_escaped(FILE* file, const char* text)
+	{
+		for (const char* c = text; *c; c++) {
+			if (*c == '"' || *c == '\\') {
+				fputc('\\', file);
+			}
+			fputc(*c, file);
+		}
+	}
+}
+
+void vktrace::record(const char* name, uint64_t startNs, uint64_t endNs)
+{
+	ThreadRing* ring = thread_ring();
+
+	uint64_t head = ring->head.load(std::memory_order_relaxed);
+
+	//pairs with the fence in copy_ring: a dump that sees any of these writes also sees a head past this zone's slot reuse
+	std::atomic_thread_fence(std::memory_order_release);
+
+	TraceSlot& slot = ring->slots[head % TRACE_RING_CAPACITY];
+	slot.name.store(name, std::memory_order_relaxed);
+	slot.startNs.store(startNs, std::memory_order_relaxed);
+	slot.durationNs.store(endNs - startNs, std::memory_order_relaxed);
+
+	ring->head.store(head + 1, std::memory_order_release);
+}
+
+void vktrace::set_thread_name(const char* name)
+{
+	ThreadRing* ring = thread_ring();
+
+	std::lock_guard<std::mutex> lock(g_ringsLock);
+	ring->name = name;
+}
+
+bool vktrace::write_chrome_trace(const char* path)
+{
+	FILE* file = fopen(path, "w");
+	if (!file) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(g_ringsLock);
+
+	//copied up front so the timestamps can start at zero
+	std::vector<std::vector<DumpedZone>> threadZones(g_rings.size());
+	uint64_t origin = UINT64_MAX;
+	for (size_t i = 0; i < g_rings.size(); i++) {
+		copy_ring(*g_rings[i], threadZones[i]);
+		for (const DumpedZone& zone : threadZones[i]) {
+			origin = std::min(origin, zone.startNs);
+		}
+	}
+
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+	bool first = true;
+	for (size_t i = 0; i < g_rings.size(); i++) {
+		const ThreadRing& ring = *g_rings[i];
+
+		fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"", first ? "" : ",", ring.threadId);
+		write_escaped(file, ring.name.c_str());
+		fprintf(file, "\"}}");
+		first = false;
+
+		//complete events, timestamps in microseconds
+		for (const DumpedZone& zone : threadZones[i]) {
+			fprintf(file, ",\n{\"name\":\"");
+			write_escaped(file, zone.name);
+			fprintf(file, "\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				ring.threadId, (zone.startNs - origin) / 1000.0, zone.durationNs / 1000.0);
+		}
+	}
+
+	fprintf(file, "\n]}\n");
+	return fclose(file) == 0;
+}
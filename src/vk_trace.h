@@ -0,0 +1,62 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+//CPU zones are recorded in debug builds and compiled out in release. Define VK_TRACE_ENABLED as 0 or 1 to override that
+#ifndef VK_TRACE_ENABLED
+#ifdef NDEBUG
+#define VK_TRACE_ENABLED 0
+#else
+#define VK_TRACE_ENABLED 1
+#endif
+#endif
+
+//zones every thread keeps. Once its ring is full a thread overwrites its oldest zones
+constexpr uint32_t TRACE_RING_CAPACITY = 1 << 15;
+
+namespace vktrace {
+
+	inline uint64_t now_ns()
+	{
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	//appends a finished zone to the calling thread's ring. Never locks, except the first time a thread records.
+	//name isn't copied, string literals are what the macros pass
+	void record(const char* name, uint64_t startNs, uint64_t endNs);
+
+	//what the calling thread is called in the trace. Threads that never set one are "thread N"
+	void set_thread_name(const char* name);
+
+	//writes the zones still in every thread's ring as Chrome trace_event JSON, for chrome://tracing or Perfetto.
+	//Can be called from any thread while the others keep recording
+	bool write_chrome_trace(const char* path);
+
+	//records the time between its construction and destruction
+	class Zone {
+	public:
+		explicit Zone(const char* name) : _name(name), _start(now_ns()) {}
+		~Zone() { record(_name, _start, now_ns()); }
+
+		Zone(const Zone&) = delete;
+		Zone& operator=(const Zone&) = delete;
+
+	private:
+		const char* _name;
+		uint64_t _start;
+	};
+}
+
+#if VK_TRACE_ENABLED
+#define VK_TRACE_CONCAT_INNER(a, b) a##b
+#define VK_TRACE_CONCAT(a, b) VK_TRACE_CONCAT_INNER(a, b)
+
+//times the rest of the enclosing scope
+#define VK_TRACE_ZONE(name) vktrace::Zone VK_TRACE_CONCAT(_traceZone, __LINE__)(name)
+#define VK_TRACE_THREAD_NAME(name) vktrace::set_thread_name(name)
+#else
+#define VK_TRACE_ZONE(name) ((void)0)
+#define VK_TRACE_THREAD_NAME(name) ((void)0)
+#endif
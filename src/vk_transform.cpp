@@ -0,0 +1,303 @@
+#include "vk_transform.h"
+#include "vk_jobs.h"
+#include "vk_trace.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+TransformId TransformHierarchy::create(TransformId parent)
+{
+	TransformId id;
+	if (!_freeIds.empty()) {
+		id = _freeIds.back();
+		_freeIds.pop_back();
+	}
+	else {
+		id = (TransformId)_slots.size();
+		_slots.push_back(UINT32_MAX);
+	}
+
+	uint32_t slot = (uint32_t)_ids.size();
+	uint32_t parentSlot = parent == INVALID_TRANSFORM ? NO_PARENT : _slots[parent];
+	uint32_t depth = parentSlot == NO_PARENT ? 0 : _depths[parentSlot] + 1;
+
+	//appending keeps the depth order unless the last slot is deeper than the new node
+	if (!_needsRebuild) {
+		if (!_depths.empty() && depth < _depths.back()) {
+			_needsRebuild = true;
+		}
+		else {
+			if (_levelOffsets.empty()) {
+				_levelOffsets.push_back(0);
+			}
+			if (depth + 1 == _levelOffsets.size()) {
+				_levelOffsets.push_back(slot);
+			}
+			_levelOffsets.back() = slot + 1;
+		}
+	}
+
+	_positions.push_back(glm::vec3{ 0.f });
+	_rotations.push_back(glm::quat{ 1.f, 0.f, 0.f, 0.f });
+	_scales.push_back(glm::vec3{ 1.f });
+	_worldMatrices.push_back(glm::mat4{ 1.f });
+	_parents.push_back(parentSlot);
+	_depths.push_back(depth);
+	_flags.push_back(NODE_DIRTY);
+	_ids.push_back(id);
+
+	_slots[id] = slot;
+	return id;
+}
+
+void TransformHierarchy::destroy(TransformId id)
+{
+	if (!is_alive(id)) {
+		return;
+	}
+	_flags[_slots[id]] |= NODE_DESTROYED;
+	_needsRebuild = true;
+}
+
+bool TransformHierarchy::is_alive(TransformId id) const
+{
+	if (id >= _slots.size() || _slots[id] == UINT32_MAX) {
+		return false;
+	}
+
+	//descendants of a destroyed node are only removed on the next update
+	for (uint32_t slot = _slots[id]; slot != NO_PARENT; slot = _parents[slot]) {
+		if (_flags[slot] & NODE_DESTROYED) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool TransformHierarchy::set_parent(TransformId id, TransformId parent)
+{
+	uint32_t slot = _slots[id];
+	uint32_t parentSlot = parent == INVALID_TRANSFORM ? NO_PARENT : _slots[parent];
+
+	for (uint32_t ancestor = parentSlot; ancestor != NO_PARENT; ancestor = _parents[ancestor]) {
+		if (ancestor == slot) {
+			return false;
+		}
+	}
+
+	_parents[slot] = parentSlot;
+	_flags[slot] |= NODE_DIRTY;
+	//the depth of the whole subtree may have changed
+	_needsRebuild = true;
+	return true;
+}
+
+TransformId TransformHierarchy::get_parent(TransformId id) const
+{
+	uint32_t parentSlot = _parents[_slots[id]];
+	return parentSlot == NO_PARENT ? INVALID_TRANSFORM : _ids[parentSlot];
+}
+
+void TransformHierarchy::set_position(TransformId id, const glm::vec3& position)
+{
+	_positions[_slots[id]] = position;
+	mark_dirty(id);
+}
+
+void TransformHierarchy::set_rotation(TransformId id, const glm::quat& rotation)
+{
+	_rotations[_slots[id]] = rotation;
+	mark_dirty(id);
+}
+
+void TransformHierarchy::set_scale(TransformId id, const glm::vec3& scale)
+{
+	_scales[_slots[id]] = scale;
+	mark_dirty(id);
+}
+
+void TransformHierarchy::set_local(TransformId id, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale)
+{
+	uint32_t slot = _slots[id];
+	_positions[slot] = position;
+	_rotations[slot] = rotation;
+	_scales[slot] = scale;
+	_flags[slot] |= NODE_DIRTY;
+}
+
+void TransformHierarchy::rebuild()
+{
+	VK_TRACE_ZONE("rebuild transforms");
+
+	uint32_t count = (uint32_t)_ids.size();
+
+	//a reparent can put children before their parents, so depths are resolved by walking up to the first
+	//node that is already resolved. Every node is walked over once. Destroyed marks spread down the same way
+	constexpr uint32_t UNRESOLVED = UINT32_MAX;
+	std::vector<uint32_t> depths(count, UNRESOLVED);
+	std::vector<uint8_t> dead(count, 0);
+	std::vector<uint32_t> chain;
+
+	for (uint32_t i = 0; i < count; i++) {
+		chain.clear();
+		uint32_t slot = i;
+		while (slot != NO_PARENT && depths[slot] == UNRESOLVED) {
+			chain.push_back(slot);
+			slot = _parents[slot];
+		}
+
+		uint32_t depth = slot == NO_PARENT ? 0 : depths[slot] + 1;
+		uint8_t parentDead = slot == NO_PARENT ? 0 : dead[slot];
+		for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+			depths[*it] = depth++;
+			parentDead = parentDead || (_flags[*it] & NODE_DESTROYED);
+			dead[*it] = parentDead;
+		}
+	}
+
+	//stable counting sort of the survivors by depth
+	uint32_t levels = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		if (!dead[i]) {
+			levels = std::max(levels, depths[i] + 1);
+		}
+	}
+
+	_levelOffsets.assign(levels + 1, 0);
+	for (uint32_t i = 0; i < count; i++) {
+		if (!dead[i]) {
+			_levelOffsets[depths[i] + 1]++;
+		}
+	}
+	for (uint32_t level = 0; level < levels; level++) {
+		_levelOffsets[level + 1] += _levelOffsets[level];
+	}
+
+	std::vector<uint32_t> newSlots(count, NO_PARENT);
+	std::vector<uint32_t> cursor(_levelOffsets.begin(), _levelOffsets.end() - 1);
+	for (uint32_t i = 0; i < count; i++) {
+		if (dead[i]) {
+			_slots[_ids[i]] = UINT32_MAX;
+			_freeIds.push_back(_ids[i]);
+		}
+		else {
+			newSlots[i] = cursor[depths[i]]++;
+		}
+	}
+
+	uint32_t liveCount = _levelOffsets[levels];
+
+	std::vector<glm::vec3> positions(liveCount);
+	std::vector<glm::quat> rotations(liveCount);
+	std::vector<glm::vec3> scales(liveCount);
+	std::vector<glm::mat4> worldMatrices(liveCount);
+	std::vector<uint32_t> parents(liveCount);
+	std::vector<uint8_t> flags(liveCount);
+	std::vector<TransformId> ids(liveCount);
+
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t slot = newSlots[i];
+		if (slot == NO_PARENT) {
+			continue;
+		}
+
+		positions[slot] = _positions[i];
+		rotations[slot] = _rotations[i];
+		scales[slot] = _scales[i];
+		worldMatrices[slot] = _worldMatrices[i];
+		parents[slot] = _parents[i] == NO_PARENT ? NO_PARENT : newSlots[_parents[i]];
+		flags[slot] = _flags[i];
+		ids[slot] = _ids[i];
+
+		_slots[_ids[i]] = slot;
+	}
+
+	_positions.swap(positions);
+	_rotations.swap(rotations);
+	_scales.swap(scales);
+	_worldMatrices.swap(worldMatrices);
+	_parents.swap(parents);
+	_flags.swap(flags);
+	_ids.swap(ids);
+
+	_depths.resize(liveCount);
+	for (uint32_t level = 0; level < levels; level++) {
+		for (uint32_t slot = _levelOffsets[level]; slot < _levelOffsets[level + 1]; slot++) {
+			_depths[slot] = level;
+		}
+	}
+
+	_needsRebuild = false;
+}
+
+void TransformHierarchy::update_range(uint32_t begin, uint32_t end)
+{
+	for (uint32_t i = begin; i < end; i++) {
+		uint32_t parent = _parents[i];
+
+		//parents are in an earlier slot, and already carry the dirty flag of their own parents
+		if (parent != NO_PARENT) {
+			_flags[i] |= _flags[parent] & NODE_DIRTY;
+		}
+		if (!(_flags[i] & NODE_DIRTY)) {
+			continue;
+		}
+
+		//translation * rotation * scale
+		glm::mat4 local = glm::mat4_cast(_rotations[i]);
+		local[0] *= _scales[i].x;
+		local[1] *= _scales[i].y;
+		local[2] *= _scales[i].z;
+		local[3] = glm::vec4(_positions[i], 1.f);
+
+		_worldMatrices[i] = parent == NO_PARENT ? local : _worldMatrices[parent] * local;
+	}
+}
+
+void TransformHierarchy::update()
+{
+	VK_TRACE_ZONE("update transforms");
+
+	if (_needsRebuild) {
+		rebuild();
+	}
+
+	update_range(0, size());
+
+	//children read the flags of their parents, so they are only cleared once every node is done
+	if (!_flags.empty()) {
+		memset(_flags.data(), 0, _flags.size());
+	}
+}
+
+void TransformHierarchy::update_parallel(JobSystem& jobSystem, uint32_t groupSize)
+{
+	VK_TRACE_ZONE("update transforms");
+
+	if (_needsRebuild) {
+		rebuild();
+	}
+
+	//a level only depends on the one before it, so each level is a parallel_for and a wait
+	for (uint32_t level = 0; level < level_count(); level++) {
+		uint32_t begin = _levelOffsets[level];
+		uint32_t count = _levelOffsets[level + 1] - begin;
+
+		//not worth the fan-out
+		if (count <= groupSize) {
+			update_range(begin, begin + count);
+			continue;
+		}
+
+		JobCounter counter;
+		jobSystem.parallel_for(count, groupSize, [this, begin](uint32_t first, uint32_t last) {
+			update_range(begin + first, begin + last);
+			}, &counter);
+		jobSystem.wait(&counter);
+	}
+
+	if (!_flags.empty()) {
+		memset(_flags.data(), 0, _flags.size());
+	}
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+class JobSystem;
+
+//stable name of a transform node. Ids of destroyed nodes are reused
+using TransformId = uint32_t;
+constexpr TransformId INVALID_TRANSFORM = UINT32_MAX;
+
+//transform nodes stored as parallel arrays (local translation/rotation/scale, world matrix, parent, dirty flag)
+//ordered by depth, so every parent comes before its children and each depth level is one contiguous range.
+//World matrices are then computed in a single forward pass, or one parallel pass per level.
+//Ids map to array slots through an indirection table, so the arrays can be reordered without invalidating them
+class TransformHierarchy {
+public:
+	//the node starts at the identity, under parent if one is given
+	TransformId create(TransformId parent = INVALID_TRANSFORM);
+
+	//destroys the node and everything under it. Their ids stop being alive right away,
+	//the storage is compacted on the next update
+	void destroy(TransformId id);
+
+	bool is_alive(TransformId id) const;
+
+	//INVALID_TRANSFORM makes the node a root. Returns false, and changes nothing, if parent is under the node
+	bool set_parent(TransformId id, TransformId parent);
+	TransformId get_parent(TransformId id) const;
+
+	void set_position(TransformId id, const glm::vec3& position);
+	void set_rotation(TransformId id, const glm::quat& rotation);
+	void set_scale(TransformId id, const glm::vec3& scale);
+	void set_local(TransformId id, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale);
+
+	const glm::vec3& get_position(TransformId id) const { return _positions[_slots[id]]; }
+	const glm::quat& get_rotation(TransformId id) const { return _rotations[_slots[id]]; }
+	const glm::vec3& get_scale(TransformId id) const { return _scales[_slots[id]]; }
+
+	//as of the last update
+	const glm::mat4& get_world_matrix(TransformId id) const { return _worldMatrices[_slots[id]]; }
+
+	//recomputes the world matrix of every node that moved, or whose ancestors moved, since the last update
+	void update();
+
+	//same as update(), with each depth level split into groups of groupSize nodes that run as jobs
+	void update_parallel(JobSystem& jobSystem, uint32_t groupSize = 4096);
+
+	//live nodes, and the ones destroyed since the last update
+	uint32_t size() const { return (uint32_t)_ids.size(); }
+
+	//depth levels of the hierarchy as of the last update
+	uint32_t level_count() const { return _levelOffsets.empty() ? 0 : (uint32_t)_levelOffsets.size() - 1; }
+
+private:
+	static constexpr uint32_t NO_PARENT = UINT32_MAX;
+
+	enum NodeFlags : uint8_t {
+		NODE_DIRTY = 1,
+		NODE_DESTROYED = 2
+	};
+
+	//computes depths, drops destroyed subtrees and sorts the arrays by depth. Runs when an update finds
+	//the order broken by a reparent, a destroy or a node created under a shallower parent
+	void rebuild();
+
+	void update_range(uint32_t begin, uint32_t end);
+
+	void mark_dirty(TransformId id) { _flags[_slots[id]] |= NODE_DIRTY; }
+
+	//per slot, in depth order
+	std::vector<glm::vec3> _positions;
+	std::vector<glm::quat> _rotations;
+	std::vector<glm::vec3> _scales;
+	std::vector<glm::mat4> _worldMatrices;
+	//slot of the parent, NO_PARENT for roots
+	std::vector<uint32_t> _parents;
+	std::vector<uint32_t> _depths;
+	std::vector<uint8_t> _flags;
+	std::vector<TransformId> _ids;
+
+	//per id, the slot it lives in. UINT32_MAX for free ids
+	std::vector<uint32_t> _slots;
+	std::vector<TransformId> _freeIds;
+
+	//first slot of every depth level, followed by the slot count
+	std::vector<uint32_t> _levelOffsets;
+
+	bool _needsRebuild{ false };
+};